@@ -0,0 +1,562 @@
+/**
+ * @file aesdload.c
+ * @brief Load generator for aesdsocket
+ *
+ * Opens N connections spread over T threads, each thread driving its share
+ * from one epoll loop.  Every request is a newline terminated packet ending
+ * in a token unique to the run, connection and sequence number; its latency
+ * is the time until that token comes back in the replay, i.e. until the
+ * server has committed the packet and streamed the store up to it.  Bytes of
+ * a replay past the token are read while waiting for the next one.
+ *
+ * With -r each connection sends on a fixed schedule and latency is measured
+ * from the scheduled time, so a stalled server is charged for the requests
+ * it delayed instead of hiding them.  Without -r connections are closed
+ * loop: the next request goes out as soon as the previous token arrived.
+ *
+ * With -k every Nth request is "AESDCHAR_IOCSEEKTO:0,0" followed by a normal
+ * packet; the pair is timed as one seek sample, the replay of the seek
+ * having no token of its own.
+ *
+ * With -B connections speak the binary protocol (proto.h) instead: each
+ * request is an APPEND frame whose latency runs until its acknowledgement,
+ * and seeks are SEEKTO frames timed until their whole reply is in.
+ *
+ * Replays return the whole store, so latency grows with it: run the server
+ * with -R or -N to benchmark a steady state.
+ */
+
+#define _GNU_SOURCE     // memmem
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include "hist.h"
+#include "proto.h"
+
+#define RECV_SIZE 65536
+#define TOKEN_MAX 48
+#define SEEK_CMD "AESDCHAR_IOCSEEKTO:0,0\n"
+
+struct load_config {
+    const char *host;
+    const char *port;
+    int connections;
+    int threads;
+    long requests;          // per connection, unless duration is set
+    double duration;        // seconds, 0 to run the requests
+    size_t packet_size;     // newline included
+    double rate;            // requests per second per connection, 0 for closed loop
+    long seek_every;
+    int timeout_ms;
+    const char *output;
+    const char *label;
+    bool binary;
+};
+
+struct load_conn {
+    int fd;
+    int id;
+    long seq;               // requests completed
+    bool waiting;           // request sent, token not seen yet
+    bool seek;
+    bool done;
+    char *pkt;              // request being sent
+    size_t pkt_len;
+    size_t sent;
+    char token[TOKEN_MAX];
+    size_t token_len;
+    char carry[TOKEN_MAX];  // tail of the last recv, a token may straddle two
+    size_t carry_len;
+    unsigned char reply_hdr[PROTO_HDR_LEN];    // binary reply header, as far as received
+    size_t reply_hdr_len;
+    size_t reply_left;      // binary reply payload bytes still to come
+    uint64_t scheduled;     // when the request is due (rate) or was sent
+};
+
+struct load_thread {
+    pthread_t thread;
+    int epfd;
+    struct load_conn *conns;
+    int nconns;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    long requests;
+    long errors;
+    struct hist latency;
+    struct hist seek_latency;
+};
+
+static struct load_config cfg = {
+    .host = "127.0.0.1",
+    .port = "9000",
+    .connections = 8,
+    .threads = 2,
+    .requests = 100,
+    .packet_size = 64,
+    .timeout_ms = 10000,
+    .label = "",
+};
+
+static unsigned run_id;
+static uint64_t run_start;
+static uint64_t run_end;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// --- Connections ---
+
+static void frame_header(char *p, uint8_t op, uint32_t len) {
+    p[0] = op;
+    p[1] = p[2] = p[3] = 0;
+    len = htonl(len);
+    memcpy(p + 4, &len, sizeof(len));
+}
+
+// Switch a fresh, still blocking connection to the binary protocol
+static int conn_hello(struct load_conn *c) {
+    char req[PROTO_HDR_LEN + sizeof(PROTO_HELLO_MAGIC) - 1];
+    unsigned char rep[PROTO_HDR_LEN + 8];
+    size_t got = 0;
+
+    frame_header(req, PROTO_OP_HELLO, sizeof(PROTO_HELLO_MAGIC) - 1);
+    memcpy(req + PROTO_HDR_LEN, PROTO_HELLO_MAGIC, sizeof(PROTO_HELLO_MAGIC) - 1);
+    if (send(c->fd, req, sizeof(req), MSG_NOSIGNAL) != (ssize_t)sizeof(req)) return -1;
+    while (got < sizeof(rep)) {
+        ssize_t n = recv(c->fd, rep + got, sizeof(rep) - got, 0);
+        if (n <= 0) {
+            if (n == 0) errno = EPROTO;
+            return -1;
+        }
+        got += n;
+    }
+    if (rep[0] != PROTO_OP_HELLO || rep[1] != PROTO_OK) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+static int conn_open(struct load_conn *c) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+
+    if (getaddrinfo(cfg.host, cfg.port, &hints, &res) != 0) return -1;
+    c->fd = -1;
+    for (struct addrinfo *ai = res; ai && c->fd < 0; ai = ai->ai_next) {
+        c->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (c->fd >= 0 && connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0) return -1;
+    if (cfg.binary && conn_hello(c) < 0) return -1;
+
+    int flags = fcntl(c->fd, F_GETFL, 0);
+    return fcntl(c->fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Build the next binary request: an APPEND of packet_size bytes, or a SEEKTO
+static void conn_prepare_frame(struct load_conn *c) {
+    if (c->seek) {
+        c->pkt_len = PROTO_HDR_LEN + 8;
+        frame_header(c->pkt, PROTO_OP_SEEKTO, 8);
+        memset(c->pkt + PROTO_HDR_LEN, 0, 8);
+    } else {
+        c->pkt_len = PROTO_HDR_LEN + cfg.packet_size;
+        frame_header(c->pkt, PROTO_OP_APPEND, cfg.packet_size);
+        memset(c->pkt + PROTO_HDR_LEN, 'x', cfg.packet_size - 1);
+        c->pkt[c->pkt_len - 1] = '\n';
+    }
+    c->reply_hdr_len = 0;
+    c->reply_left = 0;
+}
+
+// Build the next request: padding, then the token, seek command in front
+static void conn_prepare(struct load_conn *c) {
+    c->seek = cfg.seek_every > 0 && (c->seq + 1) % cfg.seek_every == 0;
+    c->sent = 0;
+    if (cfg.binary) {
+        conn_prepare_frame(c);
+        return;
+    }
+
+    c->token_len = snprintf(c->token, sizeof(c->token), "#%08x:%d.%ld\n", run_id, c->id, c->seq);
+    size_t body = cfg.packet_size > c->token_len ? cfg.packet_size : c->token_len;
+    size_t head = c->seek ? strlen(SEEK_CMD) : 0;
+    c->pkt_len = head + body;
+    memcpy(c->pkt, SEEK_CMD, head);
+    memset(c->pkt + head, 'x', body - c->token_len);
+    memcpy(c->pkt + head + body - c->token_len, c->token, c->token_len);
+    c->carry_len = 0;
+}
+
+static void conn_close(struct load_thread *t, struct load_conn *c, bool failed) {
+    if (failed) t->errors++;
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->done = true;
+}
+
+static bool conn_expired(const struct load_conn *c, uint64_t now) {
+    if (cfg.duration > 0) return now >= run_end;
+    return c->seq >= cfg.requests;
+}
+
+static void conn_arm(struct load_thread *t, struct load_conn *c) {
+    struct epoll_event ev = {
+        .events = EPOLLIN | (c->sent < c->pkt_len && c->waiting ? EPOLLOUT : 0),
+        .data.ptr = c,
+    };
+    epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void conn_send(struct load_thread *t, struct load_conn *c) {
+    while (c->sent < c->pkt_len) {
+        ssize_t n = send(c->fd, c->pkt + c->sent, c->pkt_len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_close(t, c, true);
+            return;
+        }
+        c->sent += n;
+        t->bytes_out += n;
+    }
+    conn_arm(t, c);
+}
+
+static void conn_start(struct load_thread *t, struct load_conn *c, uint64_t now) {
+    if (conn_expired(c, now)) {
+        conn_close(t, c, false);
+        return;
+    }
+    conn_prepare(c);
+    if (cfg.rate <= 0) c->scheduled = now;
+    c->waiting = true;
+    conn_send(t, c);
+}
+
+// Look for the token in the carried tail followed by the new bytes
+static bool conn_scan(struct load_conn *c, const char *buf, size_t n) {
+    size_t keep = c->token_len - 1;
+    char joint[2 * TOKEN_MAX];
+
+    size_t head = n < keep ? n : keep;
+    memcpy(joint, c->carry, c->carry_len);
+    memcpy(joint + c->carry_len, buf, head);
+    bool found = memmem(joint, c->carry_len + head, c->token, c->token_len) ||
+                 memmem(buf, n, c->token, c->token_len);
+
+    // Keep the last token_len - 1 bytes seen for the next recv
+    if (n >= keep) {
+        memcpy(c->carry, buf + n - keep, keep);
+        c->carry_len = keep;
+    } else {
+        size_t total = c->carry_len + n;
+        size_t from = total > keep ? total - keep : 0;
+        memmove(c->carry, joint + from, total - from);
+        c->carry_len = total - from;
+    }
+    return found;
+}
+
+/**
+ * Follow the binary reply to the outstanding request.
+ * @return 1 once it is complete, 0 if more is to come, -1 if it reports an error
+ */
+static int conn_parse(struct load_conn *c, const char *buf, size_t n) {
+    while (n > 0) {
+        if (c->reply_hdr_len < PROTO_HDR_LEN) {
+            size_t take = PROTO_HDR_LEN - c->reply_hdr_len;
+            if (take > n) take = n;
+            memcpy(c->reply_hdr + c->reply_hdr_len, buf, take);
+            c->reply_hdr_len += take;
+            buf += take;
+            n -= take;
+            if (c->reply_hdr_len < PROTO_HDR_LEN) return 0;
+
+            uint32_t len;
+            memcpy(&len, c->reply_hdr + 4, sizeof(len));
+            c->reply_left = ntohl(len);
+            if (c->reply_hdr[1] != PROTO_OK) return -1;
+        }
+        size_t take = c->reply_left < n ? c->reply_left : n;
+        c->reply_left -= take;
+        n -= take;
+        buf += take;
+        if (c->reply_left == 0) return 1;
+    }
+    return c->reply_hdr_len == PROTO_HDR_LEN && c->reply_left == 0;
+}
+
+static void conn_recv(struct load_thread *t, struct load_conn *c, char *buf) {
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, RECV_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_close(t, c, true);
+            return;
+        }
+        if (n == 0) {
+            conn_close(t, c, c->waiting);
+            return;
+        }
+        t->bytes_in += n;
+        if (!c->waiting) continue;
+        if (cfg.binary) {
+            int rc = conn_parse(c, buf, n);
+            if (rc < 0) {
+                conn_close(t, c, true);
+                return;
+            }
+            if (rc == 0) continue;
+        } else if (!conn_scan(c, buf, n)) {
+            continue;
+        }
+
+        uint64_t now = now_ns();
+        hist_record(c->seek ? &t->seek_latency : &t->latency, now - c->scheduled);
+        t->requests++;
+        c->seq++;
+        c->waiting = false;
+        if (cfg.rate > 0) {
+            c->scheduled += (uint64_t)(1e9 / cfg.rate);
+        } else {
+            conn_start(t, c, now);
+            if (c->done) return;
+        }
+    }
+}
+
+// --- Threads ---
+
+static void *load_thread_run(void *arg) {
+    struct load_thread *t = arg;
+    struct epoll_event events[64];
+    char *buf = malloc(RECV_SIZE);
+    int live = t->nconns;
+
+    if (!buf) return NULL;
+    for (int i = 0; i < t->nconns; i++) {
+        struct load_conn *c = &t->conns[i];
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        c->scheduled = run_start;
+    }
+
+    while (live > 0) {
+        uint64_t now = now_ns();
+        uint64_t next = now + 100000000;
+        live = 0;
+        for (int i = 0; i < t->nconns; i++) {
+            struct load_conn *c = &t->conns[i];
+            if (c->done) continue;
+            if (!c->waiting && c->scheduled <= now) conn_start(t, c, now);
+            if (c->done) continue;
+            live++;
+
+            uint64_t deadline = c->waiting ? c->scheduled + (uint64_t)cfg.timeout_ms * 1000000 : c->scheduled;
+            if (c->waiting && now >= deadline) {
+                conn_close(t, c, true);
+                live--;
+                continue;
+            }
+            if (deadline < next) next = deadline;
+        }
+        if (live == 0) break;
+
+        int timeout = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+        int n = epoll_wait(t->epfd, events, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            struct load_conn *c = events[i].data.ptr;
+            if (c->done) continue;
+            if (events[i].events & EPOLLOUT) conn_send(t, c);
+            if (!c->done && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) conn_recv(t, c, buf);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// --- Report ---
+
+static void print_hist(FILE *f, const char *name, const struct hist *h, bool json) {
+    double mean = h->count ? (double)h->sum / h->count / 1000 : 0;
+    double p50 = hist_percentile(h, 0.50) / 1000.0;
+    double p99 = hist_percentile(h, 0.99) / 1000.0;
+    double p999 = hist_percentile(h, 0.999) / 1000.0;
+    double max = h->max / 1000.0;
+
+    if (json) {
+        fprintf(f, "\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+                name, (unsigned long long)h->count, mean, p50, p99, p999, max);
+    } else if (h->count) {
+        fprintf(f, "%-13s %8llu samples  mean %9.1f  p50 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f us\n",
+                name, (unsigned long long)h->count, mean, p50, p99, p999, max);
+    }
+}
+
+static void report(struct load_thread *threads, double elapsed) {
+    struct hist *latency = calloc(2, sizeof(*latency));
+    uint64_t bytes_out = 0, bytes_in = 0;
+    long requests = 0, errors = 0;
+
+    if (!latency) return;
+    for (int i = 0; i < cfg.threads; i++) {
+        hist_merge(&latency[0], &threads[i].latency);
+        hist_merge(&latency[1], &threads[i].seek_latency);
+        bytes_out += threads[i].bytes_out;
+        bytes_in += threads[i].bytes_in;
+        requests += threads[i].requests;
+        errors += threads[i].errors;
+    }
+
+    printf("%d %s connections on %d threads, %zu byte packets, ", cfg.connections,
+           cfg.binary ? "binary" : "text", cfg.threads, cfg.packet_size);
+    if (cfg.rate > 0) printf("%.1f req/s per connection\n", cfg.rate);
+    else printf("closed loop\n");
+    printf("%ld requests, %ld errors in %.3f s: %.1f req/s, %.2f MB/s out, %.2f MB/s in\n",
+           requests, errors, elapsed, requests / elapsed, bytes_out / elapsed / 1e6, bytes_in / elapsed / 1e6);
+    print_hist(stdout, "latency", &latency[0], false);
+    print_hist(stdout, "seek latency", &latency[1], false);
+
+    if (cfg.output) {
+        FILE *f = strcmp(cfg.output, "-") == 0 ? stdout : fopen(cfg.output, "a");
+        if (!f) {
+            perror(cfg.output);
+        } else {
+            // One object per line, so successive runs can share a results file
+            fprintf(f, "{\"label\":\"%s\",\"host\":\"%s\",\"port\":\"%s\",\"connections\":%d,\"threads\":%d,"
+                       "\"binary\":%s,\"packet_size\":%zu,\"rate\":%.3f,\"seek_every\":%ld,\"elapsed_s\":%.6f,"
+                       "\"requests\":%ld,\"errors\":%ld,\"req_per_s\":%.3f,\"bytes_out\":%llu,\"bytes_in\":%llu,",
+                    cfg.label, cfg.host, cfg.port, cfg.connections, cfg.threads,
+                    cfg.binary ? "true" : "false", cfg.packet_size, cfg.rate,
+                    cfg.seek_every, elapsed, requests, errors, requests / elapsed,
+                    (unsigned long long)bytes_out, (unsigned long long)bytes_in);
+            print_hist(f, "latency_us", &latency[0], true);
+            fputc(',', f);
+            print_hist(f, "seek_latency_us", &latency[1], true);
+            fputs("}\n", f);
+            if (f != stdout) fclose(f);
+        }
+    }
+    free(latency);
+}
+
+// --- Main ---
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-t threads] [-n requests | -d seconds]\n"
+                    "       [-s packet_size] [-r rate] [-k seek_every] [-B] [-T timeout_ms] [-o results] [-l label]\n", prog);
+    fprintf(stderr, "  -c  concurrent connections (default: %d)\n", cfg.connections);
+    fprintf(stderr, "  -t  client threads (default: %d)\n", cfg.threads);
+    fprintf(stderr, "  -n  requests per connection (default: %ld)\n", cfg.requests);
+    fprintf(stderr, "  -d  run for this many seconds instead of -n\n");
+    fprintf(stderr, "  -s  packet size in bytes, newline included (default: %zu)\n", cfg.packet_size);
+    fprintf(stderr, "  -r  requests per second per connection (default: closed loop)\n");
+    fprintf(stderr, "  -k  make every Nth request a seek to the first record\n");
+    fprintf(stderr, "  -B  use the binary protocol, requests are acknowledged instead of replayed\n");
+    fprintf(stderr, "  -T  fail a request that takes longer than this (default: %d)\n", cfg.timeout_ms);
+    fprintf(stderr, "  -o  append a JSON result line to this file, - for stdout\n");
+    fprintf(stderr, "  -l  label stored with the JSON result\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:n:d:s:r:k:BT:o:l:")) != -1) {
+        switch (opt) {
+        case 'h': cfg.host = optarg; break;
+        case 'p': cfg.port = optarg; break;
+        case 'c': cfg.connections = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'n': cfg.requests = atol(optarg); break;
+        case 'd': cfg.duration = atof(optarg); break;
+        case 's': cfg.packet_size = strtoul(optarg, NULL, 10); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'k': cfg.seek_every = atol(optarg); break;
+        case 'B': cfg.binary = true; break;
+        case 'T': cfg.timeout_ms = atoi(optarg); break;
+        case 'o': cfg.output = optarg; break;
+        case 'l': cfg.label = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.connections <= 0 || cfg.threads <= 0 || cfg.requests <= 0 || cfg.packet_size == 0 ||
+        (cfg.binary && cfg.packet_size > PROTO_MAX_PAYLOAD) ||
+        cfg.duration < 0 || cfg.rate < 0 || cfg.seek_every < 0 || cfg.timeout_ms <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.threads > cfg.connections) cfg.threads = cfg.connections;
+
+    // Tokens from an earlier run may still be in the store
+    run_id = (unsigned)getpid() ^ (unsigned)now_ns();
+
+    struct load_thread *threads = calloc(cfg.threads, sizeof(*threads));
+    struct load_conn *conns = calloc(cfg.connections, sizeof(*conns));
+    size_t pkt_cap = strlen(SEEK_CMD) + PROTO_HDR_LEN + (cfg.packet_size > TOKEN_MAX ? cfg.packet_size : TOKEN_MAX);
+    if (!threads || !conns) return 1;
+
+    for (int i = 0; i < cfg.connections; i++) {
+        conns[i].id = i;
+        conns[i].pkt = malloc(pkt_cap);
+        if (!conns[i].pkt || conn_open(&conns[i]) < 0) {
+            fprintf(stderr, "Could not connect to %s:%s: %s\n", cfg.host, cfg.port, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Contiguous slices, one epoll loop per thread
+    run_start = now_ns();
+    run_end = run_start + (uint64_t)(cfg.duration * 1e9);
+    for (int i = 0, first = 0; i < cfg.threads; i++) {
+        struct load_thread *t = &threads[i];
+        t->nconns = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads);
+        t->conns = conns + first;
+        first += t->nconns;
+        t->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (t->epfd < 0 || pthread_create(&t->thread, NULL, load_thread_run, t) != 0) {
+            perror("thread");
+            return 1;
+        }
+    }
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        close(threads[i].epfd);
+    }
+    double elapsed = (now_ns() - run_start) / 1e9;
+
+    report(threads, elapsed);
+
+    long errors = 0;
+    for (int i = 0; i < cfg.threads; i++) errors += threads[i].errors;
+    for (int i = 0; i < cfg.connections; i++) {
+        if (conns[i].fd >= 0) close(conns[i].fd);
+        free(conns[i].pkt);
+    }
+    free(conns);
+    free(threads);
+    return errors ? 2 : 0;
+}
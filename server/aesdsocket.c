@@ -10,6 +10,8 @@
 * Date: 02/13/2026 
 */
 
+#define _GNU_SOURCE     // splice, pipe2
+
 #include <stdio.h>      // standard I/O
 #include <stdlib.h>     // malloc, free, exit
 #include <string.h>     // memset, strcmp, strerror
@@ -18,6 +20,7 @@
 #include <sys/types.h>  // socket types
 #include <sys/socket.h> // socket API
 #include <netinet/in.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <arpa/inet.h>  // inet_ntop
 #include <fcntl.h>      // open, O_* flags
 #include <signal.h>     // signal handling
@@ -28,30 +31,24 @@
 #include <sys/queue.h>  // SLIST macros
 #include <time.h>       // POSIX timers
 #include <sys/ioctl.h>
-#include "../aesd-char-driver/aesd_ioctl.h"
-#define PORT 9000
-#define BUFFER_SIZE 1024
-
-// Assignment 8: Build switch for character device
-#ifndef USE_AESD_CHAR_DEVICE
-#define USE_AESD_CHAR_DEVICE 1
-#endif
-
-#if USE_AESD_CHAR_DEVICE
-    #define DATA_FILE "/dev/aesdchar"
-#else
-    #define DATA_FILE "/var/tmp/aesdsocketdata"
-#endif
+#include <sys/sendfile.h> // sendfile
+#include <sys/uio.h>      // writev
+#include <limits.h>       // IOV_MAX, INT_MAX
+#include <poll.h>         // poll
+#include "aesdsocket.h"
+#include "thread-pool.h"
+#include "data-store.h"
+#include "rx-buf.h"
+#include "out-queue.h"
+#include "stats.h"
+#include "listeners.h"
+#include "proto.h"
 
 // --- Globals ---
 int server_fd = -1;
 volatile sig_atomic_t signal_caught = 0;
 pthread_mutex_t file_mutex;
 
-// --- Function Prototypes ---
-ssize_t write_all(int fd, const void *buf, size_t count);
-ssize_t send_all(int sock, const void *buf, size_t len);
-
 // --- Linked List Node Definition ---
 typedef struct thread_data_s {
     pthread_t thread_id;
@@ -78,6 +75,29 @@ ssize_t write_all(int fd, const void *buf, size_t count) {
     return total;
 }
 
+ssize_t writev_all(int fd, struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    while (iovcnt > 0) {
+        ssize_t w = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += w;
+        // Skip what was written, the last partly written entry is trimmed in place
+        while (iovcnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return total;
+}
+
 ssize_t send_all(int sock, const void *buf, size_t len) {
     size_t total = 0;
     const char *p = buf;
@@ -92,6 +112,189 @@ ssize_t send_all(int sock, const void *buf, size_t len) {
     return total;
 }
 
+void client_socket_init(int fd) {
+    int one = 1;
+
+    // Replies are streamed as they are ready; waiting on Nagle for the tail of
+    // one would stall a pipelining client for a delayed ACK
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool parse_seekto(const struct iovec *iov, int iovcnt, struct aesd_seekto *seek_params) {
+    const char *ioctl_prefix = "AESDCHAR_IOCSEEKTO:";
+    char cmd[64];
+    size_t len = 0;
+
+    // Gather into a terminated scratch buffer, sscanf must not run past the packet
+    for (int i = 0; i < iovcnt && len < sizeof(cmd) - 1; i++) {
+        size_t n = iov[i].iov_len;
+        if (n > sizeof(cmd) - 1 - len) n = sizeof(cmd) - 1 - len;
+        memcpy(cmd + len, iov[i].iov_base, n);
+        len += n;
+    }
+    cmd[len] = '\0';
+
+    if (strncmp(cmd, ioctl_prefix, strlen(ioctl_prefix)) != 0) return false;
+    return sscanf(cmd, "AESDCHAR_IOCSEEKTO:%u,%u",
+                  &seek_params->write_cmd,
+                  &seek_params->write_cmd_offset) == 2;
+}
+
+// --- Replay ---
+
+// Largest single sendfile()/splice() request; the kernel caps it near 2 GB anyway
+#define REPLAY_MAX_XFER (1U << 30)
+
+void replay_init(struct replay_ctx *rc) {
+    rc->pipe_fd[0] = rc->pipe_fd[1] = -1;
+    rc->in_pipe = 0;
+    rc->copy = false;
+    rc->off = rc->end = 0;
+    rc->skipped = 0;
+}
+
+void replay_release(struct replay_ctx *rc) {
+    if (rc->pipe_fd[0] >= 0) close(rc->pipe_fd[0]);
+    if (rc->pipe_fd[1] >= 0) close(rc->pipe_fd[1]);
+    replay_init(rc);
+}
+
+/**
+ * Pin the stored bytes at rc->off.  rc->off may move up if retention dropped
+ * them, so the bytes left are only known afterwards.
+ * @return how many bytes to move from @p span this round, 0 when the replay is done
+ */
+static size_t replay_span(struct replay_ctx *rc, struct store_span *span) {
+    off_t from = rc->off;
+    store_span_get(&rc->off, span);
+    rc->skipped += rc->off - from;
+
+    off_t left = rc->end - rc->off;
+    size_t want = span->len;
+    if (left <= 0) want = 0;
+    else if ((off_t)want > left) want = left;
+    if (want > REPLAY_MAX_XFER) want = REPLAY_MAX_XFER;
+    if (want == 0) store_span_put(span);
+    return want;
+}
+
+// Send straight out of the in-memory mirror, no filesystem involved
+static int replay_mirror(struct replay_ctx *rc, int sock, const char *src, size_t avail) {
+    if (rc->off >= rc->end) return 1;
+    if (avail > (size_t)(rc->end - rc->off)) avail = rc->end - rc->off;
+    while (avail > 0) {
+        ssize_t s = send(sock, src, avail, MSG_NOSIGNAL);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        rc->off += s;
+        src += s;
+        avail -= s;
+        stats_count(STAT_BYTES_OUT, s);
+    }
+    return 1;
+}
+
+/**
+ * Zero-copy from the store: sendfile() for the regular file, splice() through
+ * a pipe for the char device, which has no sendfile support.  Sets rc->copy and
+ * fails if the kernel refuses; rc->off is then still the next byte to send.
+ */
+static int replay_zerocopy(struct replay_ctx *rc, int sock) {
+    struct store_span span;
+    size_t want;
+
+#if USE_AESD_CHAR_DEVICE
+    if (rc->pipe_fd[0] < 0 && pipe2(rc->pipe_fd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        rc->copy = true;
+        return -1;
+    }
+    for (;;) {
+        if (rc->in_pipe == 0) {
+            if ((want = replay_span(rc, &span)) == 0) return 1;
+            loff_t pos = span.file_off;
+            ssize_t n = splice(span.fd, &pos, rc->pipe_fd[1], NULL, want, SPLICE_F_MOVE);
+            store_span_put(&span);
+            if (n == 0) return 1;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EINVAL || errno == ENOSYS) rc->copy = true;
+                return -1;
+            }
+            rc->off += n;
+            rc->in_pipe = n;
+        }
+
+        ssize_t s = splice(rc->pipe_fd[0], NULL, sock, NULL, rc->in_pipe,
+                           SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        rc->in_pipe -= s;
+        stats_count(STAT_BYTES_OUT, s);
+    }
+#else
+    while ((want = replay_span(rc, &span)) > 0) {
+        off_t pos = span.file_off;
+        ssize_t n = sendfile(sock, span.fd, &pos, want);
+        store_span_put(&span);
+        if (n > 0) {
+            rc->off += n;
+            stats_count(STAT_BYTES_OUT, n);
+            continue;
+        }
+        if (n == 0) return 1;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINVAL || errno == ENOSYS) rc->copy = true;
+        return -1;
+    }
+    return 1;
+#endif
+}
+
+// Last resort: pread() a chunk and send what the socket takes
+static int replay_copy(struct replay_ctx *rc, int sock) {
+    char read_buf[BUFFER_SIZE];
+    struct store_span span;
+    size_t want;
+
+    while ((want = replay_span(rc, &span)) > 0) {
+        if (want > sizeof(read_buf)) want = sizeof(read_buf);
+        ssize_t r = pread(span.fd, read_buf, want, span.file_off);
+        store_span_put(&span);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return r == 0 ? 1 : -1;
+
+        ssize_t s = send(sock, read_buf, r, MSG_NOSIGNAL);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        // A partial send just leaves rc->off at the first unsent byte
+        rc->off += s;
+        stats_count(STAT_BYTES_OUT, s);
+    }
+    return 1;
+}
+
+int replay_send(struct replay_ctx *rc, int sock) {
+    size_t avail;
+    const char *src = store_mirror_at(rc->off, &avail);
+    if (src) return replay_mirror(rc, sock, src, avail);
+
+    if (!rc->copy) {
+        int ret = replay_zerocopy(rc, sock);
+        if (ret >= 0 || !rc->copy) return ret;
+    }
+    return replay_copy(rc, sock);
+}
+
 // --- Thread Functions ---
 
 #if !USE_AESD_CHAR_DEVICE
@@ -109,96 +312,132 @@ void timer_thread(union sigval sigval) {
     strftime(time_str, sizeof(time_str), "%a, %d %b %Y %T %z", tmp);
     snprintf(outstr, sizeof(outstr), "timestamp:%s\n", time_str);
 
-    if (pthread_mutex_lock(&file_mutex) == 0) {
-        int fd = open(DATA_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (fd >= 0) {
-            write_all(fd, outstr, strlen(outstr));
-            close(fd);
+    uint64_t locked = stats_mutex_lock(&file_mutex);
+    store_append(outstr, strlen(outstr));
+    stats_mutex_unlock(&file_mutex, locked);
+}
+#endif
+
+void commit_seekto(const struct aesd_seekto *seek_params, off_t *start, off_t *end) {
+    uint64_t t = stats_now();
+
+    // The replay starts wherever the seek left f_pos
+    syslog(LOG_DEBUG, "Executing ioctl cmd:%u offset:%u",
+           seek_params->write_cmd, seek_params->write_cmd_offset);
+    uint64_t locked = stats_mutex_lock(&file_mutex);
+    *start = store_seekto(seek_params);
+    stats_since(HIST_SEEK, locked);
+    *end = store_end();
+    stats_mutex_unlock(&file_mutex, locked);
+    stats_count(STAT_SEEKS, 1);
+    stats_since(HIST_COMMIT, t);
+}
+
+int commit_append(const struct iovec *iov, int iovcnt, off_t *start, off_t *end) {
+    uint64_t t = stats_now();
+
+    // Grouped with whatever other clients are committing
+    int rc = store_commit(iov, iovcnt, start, end);
+    if (rc < 0) {
+        syslog(LOG_ERR, "append to %s failed: %s", DATA_FILE, strerror(errno));
+        stats_count(STAT_STORE_ERRORS, 1);
+    } else {
+        stats_count(STAT_PACKETS, 1);
+    }
+    stats_since(HIST_COMMIT, t);
+    return rc;
+}
+
+void commit_packet(const struct iovec *iov, int iovcnt, off_t *start, off_t *end) {
+    struct aesd_seekto seek_params;
+
+    // An IOCTL command, or a standard write whose replay covers everything the store still holds
+    if (parse_seekto(iov, iovcnt, &seek_params)) {
+        commit_seekto(&seek_params, start, end);
+    } else {
+        commit_append(iov, iovcnt, start, end);
+    }
+}
+
+int serve_packets(struct rx_buf *rx, struct out_queue *out, int max) {
+    int served = 0;
+    ssize_t frame_len = 0;
+
+    while (served < max && outq_accepting(out) && (frame_len = proto_frame(rx)) > 0) {
+        struct proto_reply reply;
+        if (proto_serve(rx, frame_len, &reply) < 0) return -1;
+
+        // Queue the reply, the socket takes it as fast as the client reads
+        if (outq_push(out, &reply) < 0) return -1;
+        if (outq_overrun(out)) {
+            syslog(LOG_INFO, "Dropping client %zu bytes behind", outq_bytes(out));
+            stats_count(STAT_DROPPED, 1);
+            return -1;
         }
-        pthread_mutex_unlock(&file_mutex);
+        served++;
+    }
+    if (frame_len < 0) {
+        syslog(LOG_INFO, "Dropping client that sent an oversized frame");
+        return -1;
     }
+    return served;
 }
-#endif
 
 void* thread_handler(void* thread_param) {
     thread_data_t* data = (thread_data_t*)thread_param;
-    char* packet_buffer = NULL;
-    size_t current_buffer_size = BUFFER_SIZE;
-    size_t total_received = 0;
-    ssize_t bytes_received;
-
-    packet_buffer = (char*)malloc(current_buffer_size);
-    if (!packet_buffer) goto cleanup_thread;
-
-    while ((bytes_received = recv(data->client_fd, packet_buffer + total_received, 
-                                  current_buffer_size - total_received, 0)) > 0) {
-        
-        total_received += bytes_received;
-        
-        // If newline detected, write to device and read back
-        if (memchr(packet_buffer + total_received - bytes_received, '\n', bytes_received) != NULL) {
-            
-            pthread_mutex_lock(&file_mutex);
-            
-            // 1. Check if the incoming packet is an IOCTL command
-            const char *ioctl_prefix = "AESDCHAR_IOCSEEKTO:";
-            struct aesd_seekto seek_params;
-            int is_ioctl = 0;
-
-            if (strncmp(packet_buffer, ioctl_prefix, strlen(ioctl_prefix)) == 0) {
-                if (sscanf(packet_buffer, "AESDCHAR_IOCSEEKTO:%u,%u", 
-                           &seek_params.write_cmd, 
-                           &seek_params.write_cmd_offset) == 2) {
-                    is_ioctl = 1;
-                }
-            }
-
-            int file_fd = open(DATA_FILE, O_RDWR | O_APPEND | O_CREAT, 0644);
-            if (file_fd >= 0) {
-                
-                if (is_ioctl) {
-                    // 2a. Execute IOCTL
-                    syslog(LOG_DEBUG, "Executing ioctl cmd:%u offset:%u", 
-                           seek_params.write_cmd, seek_params.write_cmd_offset);
-                    ioctl(file_fd, AESDCHAR_IOCSEEKTO, &seek_params);
-                
-                } else {
-                    // 2b. Standard Write
-                    write_all(file_fd, packet_buffer, total_received);
-                    
-                    // Re-open for clean reading from the start (offset 0)
-                    close(file_fd);
-                    file_fd = open(DATA_FILE, O_RDONLY);
-                }
-                
-                // 3. Read everything back from the driver
-                if (file_fd >= 0) {
-                    char read_buf[BUFFER_SIZE];
-                    ssize_t read_bytes;
-                    while ((read_bytes = read(file_fd, read_buf, sizeof(read_buf))) > 0) {
-                        send_all(data->client_fd, read_buf, read_bytes);
-                    }
-                    close(file_fd); // Finally, close it once the transaction is done
-                }
-            }
-            
-            pthread_mutex_unlock(&file_mutex);
-            
-            // Clear the buffer to prevent leftover string fragments from messing up future parses
-            memset(packet_buffer, 0, current_buffer_size); 
-            total_received = 0; 
+    int fd = data->client_fd;
+    struct rx_buf rx;
+    struct out_queue out;
+    bool eof = false;
+
+    rx_buf_init(&rx);
+    outq_init(&out);
+
+    // Non-blocking, so the thread keeps reading while a slow client drains its replays
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) goto done;
+
+    for (;;) {
+        // One commit and replay per line, the partial tail waits for more bytes
+        int served = serve_packets(&rx, &out, INT_MAX);
+        if (served < 0) break;
+        int rc = outq_flush(&out, fd);
+        if (rc < 0) break;
+        if (rc == 1 && served > 0) continue;    // drained, packets held back may go now
+        if (eof && rc == 1) break;
+
+        bool reading = !eof && outq_accepting(&out);
+        struct pollfd pfd = {
+            .fd = fd,
+            .events = (reading ? POLLIN : 0) | (rc == 0 ? POLLOUT : 0),
+        };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
-        else if (total_received == current_buffer_size) {
-            current_buffer_size *= 2;
-            char *tmp = realloc(packet_buffer, current_buffer_size);
-            if (!tmp) break; 
-            packet_buffer = tmp;
+        if (!reading || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+        size_t room;
+        char *space = rx_buf_space(&rx, &room);
+        if (!space) break;
+        uint64_t t = stats_now();
+        ssize_t n = recv(fd, space, room, 0);
+        stats_since(HIST_RECV, t);
+        if (n > 0) {
+            stats_count(STAT_BYTES_IN, n);
+            rx_buf_added(&rx, n);
+        } else if (n == 0) {
+            eof = true;     // still owe the replays already queued
+        } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
         }
     }
 
-cleanup_thread:
-    if (packet_buffer) free(packet_buffer);
+done:
+    outq_release(&out);
+    rx_buf_release(&rx);
     close(data->client_fd);
+    stats_conn_close();
     data->thread_complete = true;
     return NULL;
 }
@@ -209,7 +448,7 @@ void handle_signal(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
         syslog(LOG_INFO, "Caught signal, exiting");
         signal_caught = 1;
-        if (server_fd != -1) shutdown(server_fd, SHUT_RDWR);
+        listeners_shutdown();
     }
 }
 
@@ -232,7 +471,7 @@ void make_daemon() {
     long maxfd = sysconf(_SC_OPEN_MAX);
     if (maxfd < 0) maxfd = 1024;
     for (int fd = (int)maxfd; fd >= 0; fd--) {
-        if (fd != server_fd) close(fd);
+        if (!listeners_owns(fd)) close(fd);
     }
 
     int devnull = open("/dev/null", O_RDWR);
@@ -244,15 +483,183 @@ void make_daemon() {
     }
 }
 
+// --- Connection Models ---
+
+// Original model: one blocking thread per client, reaped after each accept
+void run_thread_model(void) {
+    while (!signal_caught) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        int new_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (new_fd < 0) {
+            if (signal_caught) break;
+            continue;
+        }
+
+        client_socket_init(new_fd);
+        stats_conn_open();
+        thread_data_t *new_node = (thread_data_t *)malloc(sizeof(thread_data_t));
+        if (!new_node) {
+            close(new_fd);
+            stats_conn_close();
+        } else {
+            new_node->client_fd = new_fd;
+            new_node->thread_complete = false;
+            if (pthread_create(&new_node->thread_id, NULL, thread_handler, new_node) != 0) {
+                close(new_fd);
+                free(new_node);
+                stats_conn_close();
+            } else {
+                SLIST_INSERT_HEAD(&head, new_node, entries);
+            }
+        }
+
+        thread_data_t *cursor = SLIST_FIRST(&head);
+        while (cursor != NULL) {
+            thread_data_t *temp = SLIST_NEXT(cursor, entries);
+            if (cursor->thread_complete) {
+                pthread_join(cursor->thread_id, NULL);
+                SLIST_REMOVE(&head, cursor, thread_data_s, entries);
+                free(cursor);
+            }
+            cursor = temp;
+        }
+    }
+
+    while (!SLIST_EMPTY(&head)) {
+        thread_data_t *elem = SLIST_FIRST(&head);
+        shutdown(elem->client_fd, SHUT_RDWR);
+        pthread_join(elem->thread_id, NULL);
+        SLIST_REMOVE_HEAD(&head, entries);
+        free(elem);
+    }
+}
+
 // --- Main ---
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d] [-M] [-S] [-R bytes] [-N records] [-H bytes] [-L bytes] [-K] [-s path]\n"
+                    "       [-m thread|epoll|pool|uring] [-w workers] [-P] [-b backlog]\n", prog);
+    fprintf(stderr, "  -d  run as a daemon\n");
+    fprintf(stderr, "  -M  mirror DATA_FILE in memory and replay from it\n");
+    fprintf(stderr, "  -S  fdatasync every group commit before replying\n");
+    fprintf(stderr, "  -R  keep at most this many bytes in the file log (default: unbounded)\n");
+    fprintf(stderr, "  -N  keep at most this many records in the file log (default: unbounded)\n");
+    fprintf(stderr, "  -H  stop reading from a client owing this many replay bytes (default: %zu)\n", OUTQ_DEFAULT_HIGH);
+    fprintf(stderr, "  -L  resume reading once it is down to this many (default: a quarter of -H)\n");
+    fprintf(stderr, "  -K  disconnect a client that reaches -H instead of pausing it\n");
+    fprintf(stderr, "  -s  serve counters and latency histograms on this Unix socket\n");
+    fprintf(stderr, "  -m  connection model (default: thread)\n");
+    fprintf(stderr, "  -w  worker threads for -m pool, listeners for -P (default: online CPUs)\n");
+    fprintf(stderr, "  -P  one SO_REUSEPORT listener and event loop per CPU, for -m epoll|uring\n");
+    fprintf(stderr, "  -b  listen backlog (default: %d)\n", LISTEN_BACKLOG_DEFAULT);
+}
+
 int main(int argc, char *argv[]) {
-    bool daemon_mode = (argc == 2 && strcmp(argv[1], "-d") == 0);
-    struct sockaddr_in address;
-    int optval = 1;
+    bool daemon_mode = false;
+    struct store_config store_cfg = { 0 };
+    struct outq_limits out_limits = { .high = OUTQ_DEFAULT_HIGH, .low = 0 };
+    const char *stats_path = NULL;
+    enum server_model model = MODEL_THREAD;
+    int nworkers = 0;
+    bool per_core = false;
+    int backlog = LISTEN_BACKLOG_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dMSR:N:H:L:Ks:m:w:Pb:")) != -1) {
+        switch (opt) {
+        case 'd':
+            daemon_mode = true;
+            break;
+        case 'M':
+            store_cfg.mirror = true;
+            break;
+        case 'S':
+            store_cfg.sync = true;
+            break;
+        case 'R':
+        case 'N':
+        case 'H':
+        case 'L': {
+            char *end;
+            unsigned long long limit = strtoull(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || limit == 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            if (opt == 'R') store_cfg.retain_bytes = limit;
+            else if (opt == 'N') store_cfg.retain_records = limit;
+            else if (opt == 'H') out_limits.high = limit;
+            else out_limits.low = limit;
+            break;
+        }
+        case 'K':
+            out_limits.drop = true;
+            break;
+        case 's':
+            stats_path = optarg;
+            break;
+        case 'm':
+            if (strcmp(optarg, "thread") == 0) {
+                model = MODEL_THREAD;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                model = MODEL_EPOLL;
+            } else if (strcmp(optarg, "pool") == 0) {
+                model = MODEL_POOL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                model = MODEL_URING;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'P':
+            per_core = true;
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            if (backlog <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (out_limits.low == 0) out_limits.low = out_limits.high / 4;
+    if (out_limits.low > out_limits.high) {
+        usage(argv[0]);
+        return -1;
+    }
+    outq_configure(&out_limits);
+
+    // Only the run-to-completion loops can be replicated per core
+    if (per_core && model != MODEL_EPOLL && model != MODEL_URING) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (nworkers == 0) nworkers = per_core ? listeners_cpu_count() : thread_pool_default_size();
+    if (per_core && nworkers > LISTENERS_MAX) nworkers = LISTENERS_MAX;
+
+#if !USE_AESD_CHAR_DEVICE
+    timer_t timer_id;
+    bool timer_created = false;
+#endif
 
     pthread_mutex_init(&file_mutex, NULL);
     SLIST_INIT(&head);
+    stats_init();
 
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -261,33 +668,28 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTERM, &sa, NULL);
     signal(SIGPIPE, SIG_IGN);
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) return -1;
+    if (listeners_bind(per_core ? nworkers : 1) < 0) return -1;
 
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (daemon_mode) make_daemon();
 
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    openlog("aesdsocket", LOG_PID, LOG_USER);
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        close(server_fd);
-        return -1;
+    // Opened after daemonizing, make_daemon() closes every other descriptor
+    if (store_open(&store_cfg) < 0) {
+        syslog(LOG_ERR, "Could not open %s: %s", DATA_FILE, strerror(errno));
+        goto cleanup;
     }
 
-    if (daemon_mode) make_daemon();
-
-    openlog("aesdsocket", LOG_PID, LOG_USER);
+    if (stats_path && stats_serve(stats_path) < 0) {
+        syslog(LOG_WARNING, "Could not serve stats on %s: %s", stats_path, strerror(errno));
+    }
 
-    if (listen(server_fd, 10) < 0) {
-        syslog(LOG_ERR, "Listen failed");
+    if (listeners_listen(backlog) < 0) {
+        syslog(LOG_ERR, "Listen failed: %s", strerror(errno));
         goto cleanup;
     }
 
 #if !USE_AESD_CHAR_DEVICE
-    timer_t timer_id;
-    bool timer_created = false;
     struct sigevent sev;
     struct itimerspec its;
 
@@ -305,56 +707,34 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
-    while (!signal_caught) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-
-        int new_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (new_fd < 0) {
-            if (signal_caught) break;
-            continue;
-        }
-
-        thread_data_t *new_node = (thread_data_t *)malloc(sizeof(thread_data_t));
-        if (new_node) {
-            new_node->client_fd = new_fd;
-            new_node->thread_complete = false;
-            if (pthread_create(&new_node->thread_id, NULL, thread_handler, new_node) != 0) {
-                close(new_fd);
-                free(new_node);
+    if (per_core) {
+        if (listeners_run(model) < 0) syslog(LOG_ERR, "per-core listeners failed: %s", strerror(errno));
+    } else if (model == MODEL_EPOLL) {
+        if (reactor_run(server_fd) < 0) syslog(LOG_ERR, "epoll reactor failed: %s", strerror(errno));
+    } else if (model == MODEL_URING) {
+        if (uring_model_run(server_fd) < 0) {
+            if (errno == ENOSYS && !signal_caught) {
+                syslog(LOG_WARNING, "io_uring not supported, falling back to thread model");
+                run_thread_model();
             } else {
-                SLIST_INSERT_HEAD(&head, new_node, entries);
-            }
-        }
-
-        thread_data_t *cursor = SLIST_FIRST(&head);
-        while (cursor != NULL) {
-            thread_data_t *temp = SLIST_NEXT(cursor, entries);
-            if (cursor->thread_complete) {
-                pthread_join(cursor->thread_id, NULL);
-                SLIST_REMOVE(&head, cursor, thread_data_s, entries);
-                free(cursor);
+                syslog(LOG_ERR, "io_uring backend failed: %s", strerror(errno));
             }
-            cursor = temp;
         }
+    } else if (model == MODEL_POOL) {
+        if (pool_model_run(server_fd, nworkers) < 0) syslog(LOG_ERR, "worker pool failed: %s", strerror(errno));
+    } else {
+        run_thread_model();
     }
 
 cleanup:
-    while (!SLIST_EMPTY(&head)) {
-        thread_data_t *elem = SLIST_FIRST(&head);
-        shutdown(elem->client_fd, SHUT_RDWR);
-        pthread_join(elem->thread_id, NULL);
-        SLIST_REMOVE_HEAD(&head, entries);
-        free(elem);
-    }
-
 #if !USE_AESD_CHAR_DEVICE
     if (timer_created) timer_delete(timer_id);
-    unlink(DATA_FILE); 
 #endif
+    stats_stop();
+    store_close();  // also deletes the file log
 
     pthread_mutex_destroy(&file_mutex);
-    if (server_fd != -1) close(server_fd);
+    listeners_close();
     closelog();
     
     return 0;
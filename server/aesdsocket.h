@@ -0,0 +1,148 @@
+/**
+ * @file aesdsocket.h
+ * @brief Definitions shared between the aesdsocket main loop and its connection models
+ *
+ * The server can run the original thread-per-connection model, an
+ * edge-triggered epoll reactor (see reactor.c), a work-stealing worker pool
+ * (see pool-model.c) or an io_uring proactor (see uring-model.c).  All of them speak the same newline framed protocol on
+ * PORT and commit packets to DATA_FILE.
+ */
+
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <signal.h>     // sig_atomic_t
+#include <pthread.h>    // pthread_mutex_t
+#include <stdbool.h>    // bool type
+#include <stddef.h>     // size_t
+#include <sys/types.h>  // ssize_t
+#include <sys/uio.h>    // struct iovec
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+#define PORT 9000
+#define BUFFER_SIZE 1024
+
+// Assignment 8: Build switch for character device
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE 1
+#endif
+
+#if USE_AESD_CHAR_DEVICE
+    #define DATA_FILE "/dev/aesdchar"
+#else
+    #define DATA_FILE "/var/tmp/aesdsocketdata"
+#endif
+
+// Connection handling model, selected at startup with -m
+enum server_model {
+    MODEL_THREAD,   // one blocking thread per accepted client (original behaviour)
+    MODEL_EPOLL,    // single threaded edge-triggered epoll reactor
+    MODEL_POOL,     // fixed size work-stealing pool fed by an accept loop
+    MODEL_URING,    // single threaded io_uring proactor, falls back to MODEL_THREAD
+};
+
+// --- Globals (defined in aesdsocket.c) ---
+extern int server_fd;
+extern volatile sig_atomic_t signal_caught;
+extern pthread_mutex_t file_mutex;
+
+// --- Helpers (aesdsocket.c) ---
+ssize_t write_all(int fd, const void *buf, size_t count);
+ssize_t send_all(int sock, const void *buf, size_t len);
+/** Write every iovec, retrying short writes.  Advances @p iov in place. */
+ssize_t writev_all(int fd, struct iovec *iov, int iovcnt);
+/** Socket options every accepted client gets, whatever the model. */
+void client_socket_init(int fd);
+
+/**
+ * Parse an "AESDCHAR_IOCSEEKTO:X,Y" command at the start of the packet held
+ * in the @p iovcnt pieces of @p iov.
+ * @return true and fill @p seek_params when the packet is a seek command
+ */
+bool parse_seekto(const struct iovec *iov, int iovcnt, struct aesd_seekto *seek_params);
+
+// Replay state for one client
+struct replay_ctx {
+    off_t off;          // next DATA_FILE offset to send
+    off_t end;          // store_end() snapshot taken at commit, the replay stops here
+    int pipe_fd[2];     // splice() pipe between DATA_FILE and the socket, -1 until needed
+    size_t in_pipe;     // bytes spliced into the pipe but not yet into the socket
+    bool copy;          // the kernel refused zero-copy, stream through a buffer instead
+    off_t skipped;      // bytes retention dropped before they could be sent
+};
+
+void replay_init(struct replay_ctx *rc);
+void replay_release(struct replay_ctx *rc);
+
+/**
+ * Stream the store from rc->off to rc->end into @p sock: from the in-memory
+ * mirror when there is one, otherwise zero-copy (sendfile() for the regular
+ * file, splice() through a pipe for the char device) and, if the kernel
+ * refuses that, pread()/send().  Works on blocking and non-blocking sockets.
+ * No lock is needed: the snapshot bounds the replay to data already committed.
+ * @return 1 when the replay is complete, 0 when the socket would block, -1 on error
+ */
+int replay_send(struct replay_ctx *rc, int sock);
+
+/**
+ * Run an AESDCHAR_IOCSEEKTO command.  Takes file_mutex itself.
+ * @param start, end  the store range to replay, from the seek position on
+ */
+void commit_seekto(const struct aesd_seekto *seek_params, off_t *start, off_t *end);
+
+/**
+ * Append one record, gathered from @p iovcnt pieces, through the group
+ * commit.  The caller must not hold file_mutex.
+ * @param start, end  the store range right after the commit
+ * @return 0 on success, -1 if the write failed
+ */
+int commit_append(const struct iovec *iov, int iovcnt, off_t *start, off_t *end);
+
+/**
+ * Commit one packet, gathered from @p iovcnt pieces, to DATA_FILE: append it through the group commit, or run
+ * the seek command it holds.  Takes file_mutex itself; the caller must not hold it.
+ * @param start, end  the store range to replay, snapshotted with the commit
+ */
+void commit_packet(const struct iovec *iov, int iovcnt, off_t *start, off_t *end);
+
+struct rx_buf;
+struct out_queue;
+
+/**
+ * Serve up to @p max complete requests buffered in @p rx, in whichever
+ * protocol the client speaks (proto.h), queuing the reply to each on @p out.
+ * Stops early once @p out reaches its high watermark; the rest stay
+ * buffered.
+ * @return the number of requests served, -1 if the client must be dropped
+ * (out of memory, a malformed frame, or too far behind under the drop policy)
+ */
+int serve_packets(struct rx_buf *rx, struct out_queue *out, int max);
+
+// --- Reactor model (reactor.c) ---
+
+/**
+ * Serve clients on @p listen_fd from an edge-triggered epoll loop until
+ * signal_caught is set.
+ * @return 0 on clean shutdown, -1 if the event loop could not be set up
+ */
+int reactor_run(int listen_fd);
+
+// --- Worker pool model (pool-model.c) ---
+
+/**
+ * Accept clients on @p listen_fd and serve them from a pool of @p nworkers
+ * threads until signal_caught is set.
+ * @return 0 on clean shutdown, -1 if the pool could not be set up
+ */
+int pool_model_run(int listen_fd, int nworkers);
+
+// --- io_uring model (uring-model.c) ---
+
+/**
+ * Serve clients on @p listen_fd through io_uring until signal_caught is set.
+ * @return 0 on clean shutdown, -1 on failure; errno is ENOSYS when the
+ * running kernel lacks the io_uring support this model needs
+ */
+int uring_model_run(int listen_fd);
+
+#endif /* AESDSOCKET_H */
@@ -0,0 +1,53 @@
+#!/bin/bash
+# Benchmark aesdsocket on loopback with aesdload.
+# Builds the file backed server and the load generator, then runs each
+# scenario against every connection model on a fresh store, appending one
+# JSON line per run to the results file.
+#
+# Usage: ./bench.sh [results.jsonl] [models...]
+# PORT, RETAIN and DURATION override the defaults below.
+
+set -e
+cd `dirname $0`
+
+results=${1:-bench-results.jsonl}
+shift || true
+models=${@:-thread epoll pool uring}
+port=${PORT:-9000}
+# Replays return the whole store, retention keeps their size steady
+retain=${RETAIN:-262144}
+duration=${DURATION:-5}
+datafile=/var/tmp/aesdsocketdata
+
+# name: aesdload options
+scenarios=(
+    "small-closed:-c 16 -t 4 -s 64"
+    "large-closed:-c 16 -t 4 -s 16384"
+    "many-conns:-c 256 -t 4 -s 64"
+    "paced:-c 64 -t 4 -s 256 -r 100"
+    "seeks:-c 16 -t 4 -s 64 -k 4"
+    "binary-append:-c 16 -t 4 -s 64 -B"
+)
+
+make -s clean
+make -s CFLAGS="-O2 -Wall -Werror -I../aesd-char-driver -DUSE_AESD_CHAR_DEVICE=0" aesdsocket aesdload
+
+for model in $models; do
+    for scenario in "${scenarios[@]}"; do
+        name=${scenario%%:*}
+        rm -rf ${datafile}*
+        ./aesdsocket -m $model -R $retain &
+        server=$!
+        # Wait for the listener
+        for i in `seq 50`; do
+            (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+            sleep 0.1
+        done
+        echo "== $model $name"
+        ./aesdload -p $port -d $duration ${scenario#*:} -l "$model/$name" -o "$results" || echo "aesdload failed: $?"
+        kill $server
+        wait $server || true
+    done
+done
+rm -rf ${datafile}*
+echo "Results appended to $results"
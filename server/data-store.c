@@ -0,0 +1,328 @@
+/**
+ * @file data-store.c
+ * @brief DATA_FILE backing store shared by every connection model
+ *
+ * The mirror lives in one address range reserved at startup, so appends never
+ * move bytes that a replay may be sending.  The writer copies an append in
+ * and then publishes the new length; readers load the length and may use
+ * everything below it without a lock, because mirrored bytes are never
+ * rewritten.  If the data outgrows the reservation the mirror is dropped and
+ * replays fall back to the log.
+ *
+ * The char device build never mirrors: the driver keeps only the last writes
+ * and evicts older ones, so its contents are not an append-only log.
+ *
+ * Packets are committed in groups.  Writers queue a request on commit_queue;
+ * the first one to find no leader drains the queue under file_mutex with one
+ * writev per segment run and at most one fdatasync each, then wakes everyone
+ * whose record went out.  Writers arriving meanwhile form the next group, so
+ * under load the write syscalls per packet drop instead of piling up on
+ * file_mutex.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "aesdsocket.h"
+#include "data-store.h"
+#include "seg-log.h"
+#include "stats.h"
+
+// Address space reserved for the mirror; pages are only backed once written
+#define MIRROR_RESERVE (UINTPTR_MAX > 0xffffffffU ? ((size_t)1 << 32) : ((size_t)256 << 20))
+// Records per writev in a group commit
+#define COMMIT_BATCH SEGLOG_MAX_BATCH
+
+struct commit_req {
+    struct seglog_rec rec;
+    int rc;
+    off_t head;
+    off_t end;
+    bool done;
+    struct commit_req *next;
+};
+
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_done = PTHREAD_COND_INITIALIZER;
+static struct commit_req *commit_queue;     // waiting for the next group, oldest first
+static struct commit_req **commit_tail = &commit_queue;
+static bool commit_leader;                  // a group is being written
+
+#if USE_AESD_CHAR_DEVICE
+static int data_fd = -1;
+static struct iovec *flat_iov;  // scratch for flattening a group, grows as needed
+static int flat_cap;
+#else
+static bool sync_commits;
+#endif
+
+static char *mirror;            // MIRROR_RESERVE bytes, or NULL
+static size_t mirror_len;       // published with release, read with acquire
+static bool mirror_on;          // cleared once the mirror stops tracking DATA_FILE
+
+#if !USE_AESD_CHAR_DEVICE
+static void mirror_drop(void) {
+    // Readers may still hold pointers into it, the mapping stays until store_close()
+    __atomic_store_n(&mirror_on, false, __ATOMIC_RELEASE);
+}
+
+static bool mirror_put(const void *buf, size_t len) {
+    size_t cur = mirror_len;
+    if (len > MIRROR_RESERVE - cur) return false;
+    memcpy(mirror + cur, buf, len);
+    __atomic_store_n(&mirror_len, cur + len, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Copy what the log holds into the mirror; offsets before the head stay unused
+static int mirror_load(void) {
+    off_t off = seglog_head();
+    off_t end = seglog_end();
+
+    if ((size_t)end > MIRROR_RESERVE) return -1;
+    while (off < end) {
+        struct seglog_span span;
+        seglog_span_get(&off, &span);
+        if (span.len == 0) break;
+
+        ssize_t n = pread(span.fd, mirror + off, span.len, span.file_off);
+        seglog_span_put(&span);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        off += n;
+    }
+    __atomic_store_n(&mirror_len, off, __ATOMIC_RELEASE);
+    return 0;
+}
+#endif
+
+int store_open(const struct store_config *cfg) {
+#if USE_AESD_CHAR_DEVICE
+    data_fd = open(DATA_FILE, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (data_fd < 0) return -1;
+    if (cfg->mirror) syslog(LOG_WARNING, "%s is not append-only, replays read the device", DATA_FILE);
+    if (cfg->sync) syslog(LOG_WARNING, "%s cannot be synced, ignoring -S", DATA_FILE);
+#else
+    if (seglog_open(DATA_FILE, cfg->retain_bytes, cfg->retain_records) < 0) return -1;
+    sync_commits = cfg->sync;
+    if (!cfg->mirror) return 0;
+
+    mirror = mmap(NULL, MIRROR_RESERVE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mirror == MAP_FAILED) {
+        mirror = NULL;
+        syslog(LOG_WARNING, "Could not reserve the data mirror: %s", strerror(errno));
+        return 0;
+    }
+    if (mirror_load() < 0) {
+        syslog(LOG_WARNING, "Could not load %s into memory, replays read the file", DATA_FILE);
+    } else {
+        mirror_on = true;
+    }
+#endif
+    return 0;
+}
+
+void store_close(void) {
+    if (mirror) munmap(mirror, MIRROR_RESERVE);
+    mirror = NULL;
+    mirror_len = 0;
+    mirror_on = false;
+#if USE_AESD_CHAR_DEVICE
+    if (data_fd >= 0) close(data_fd);
+    data_fd = -1;
+    free(flat_iov);
+    flat_iov = NULL;
+    flat_cap = 0;
+#else
+    seglog_close();
+#endif
+}
+
+// Append up to COMMIT_BATCH records to the backing store and the mirror.  Caller holds file_mutex.
+static int store_writev(const struct seglog_rec *recs, int cnt) {
+#if USE_AESD_CHAR_DEVICE
+    // The driver turns each iovec into its own write and holds a record back
+    // until its newline, so pieces of one record still make one entry
+    int niov = 0;
+    for (int i = 0; i < cnt; i++) niov += recs[i].iovcnt;
+    if (niov > flat_cap) {
+        struct iovec *tmp = realloc(flat_iov, niov * sizeof(*tmp));
+        if (!tmp) return -1;
+        flat_iov = tmp;
+        flat_cap = niov;
+    }
+    niov = 0;
+    for (int i = 0; i < cnt; i++) {
+        memcpy(flat_iov + niov, recs[i].iov, recs[i].iovcnt * sizeof(*flat_iov));
+        niov += recs[i].iovcnt;
+    }
+    return writev_all(data_fd, flat_iov, niov) < 0 ? -1 : 0;
+#else
+    if (seglog_append(recs, cnt, sync_commits) < 0) {
+        // Part of it may be on disk, the mirror can no longer be trusted
+        mirror_drop();
+        return -1;
+    }
+    if (!__atomic_load_n(&mirror_on, __ATOMIC_RELAXED)) return 0;
+    for (int i = 0; i < cnt; i++) {
+        for (int j = 0; j < recs[i].iovcnt; j++) {
+            if (!mirror_put(recs[i].iov[j].iov_base, recs[i].iov[j].iov_len)) {
+                syslog(LOG_WARNING, "%s outgrew the data mirror, replays read the file", DATA_FILE);
+                mirror_drop();
+                return 0;
+            }
+        }
+    }
+    return 0;
+#endif
+}
+
+static int store_appendv(const struct seglog_rec *recs, int cnt) {
+    uint64_t t = stats_now();
+    int rc = store_writev(recs, cnt);
+    stats_since(HIST_STORE_WRITE, t);
+    return rc;
+}
+
+int store_append(const void *buf, size_t len) {
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    struct seglog_rec rec = { .iov = &iov, .iovcnt = 1, .len = len };
+    return store_appendv(&rec, 1);
+}
+
+// Leader: write a whole group under one file_mutex hold
+static void commit_group(struct commit_req *group) {
+    struct seglog_rec recs[COMMIT_BATCH];
+
+    uint64_t locked = stats_mutex_lock(&file_mutex);
+    for (struct commit_req *first = group; first != NULL; ) {
+        struct commit_req *r = first;
+        int cnt = 0;
+        for (; r != NULL && cnt < COMMIT_BATCH; r = r->next, cnt++) recs[cnt] = r->rec;
+        int rc = store_appendv(recs, cnt);
+        for (; first != r; first = first->next) first->rc = rc;
+    }
+
+    off_t head = store_head();
+    off_t end = store_end();
+    stats_mutex_unlock(&file_mutex, locked);
+
+    for (struct commit_req *r = group; r != NULL; r = r->next) {
+        r->head = head;
+        r->end = end;
+    }
+}
+
+int store_commit(const struct iovec *iov, int iovcnt, off_t *head, off_t *end) {
+    struct commit_req req = { .rec = { .iov = iov, .iovcnt = iovcnt } };
+    for (int i = 0; i < iovcnt; i++) req.rec.len += iov[i].iov_len;
+
+    pthread_mutex_lock(&commit_lock);
+    *commit_tail = &req;
+    commit_tail = &req.next;
+
+    while (!req.done) {
+        if (commit_leader) {
+            pthread_cond_wait(&commit_done, &commit_lock);
+            continue;
+        }
+
+        // Lead the next group: everything queued so far, this request included
+        struct commit_req *group = commit_queue;
+        commit_queue = NULL;
+        commit_tail = &commit_queue;
+        commit_leader = true;
+        pthread_mutex_unlock(&commit_lock);
+
+        commit_group(group);
+
+        pthread_mutex_lock(&commit_lock);
+        while (group) {
+            // Read next first, the waiter's request is gone once it sees done
+            struct commit_req *next = group->next;
+            group->done = true;
+            group = next;
+        }
+        commit_leader = false;
+        pthread_cond_broadcast(&commit_done);
+    }
+    pthread_mutex_unlock(&commit_lock);
+
+    *head = req.head;
+    *end = req.end;
+    return req.rc;
+}
+
+off_t store_head(void) {
+#if USE_AESD_CHAR_DEVICE
+    return 0;
+#else
+    return seglog_head();
+#endif
+}
+
+off_t store_end(void) {
+#if USE_AESD_CHAR_DEVICE
+    // The driver drops old writes and holds back partial ones, ask it; the
+    // position this moves is only read right after a seek ioctl
+    off_t end = lseek(data_fd, 0, SEEK_END);
+    return end > 0 ? end : 0;
+#else
+    return seglog_end();
+#endif
+}
+
+off_t store_seekto(const struct aesd_seekto *seek_params) {
+#if USE_AESD_CHAR_DEVICE
+    // The ioctl moves the file position of data_fd; nothing else relies on it
+    if (ioctl(data_fd, AESDCHAR_IOCSEEKTO, seek_params) != 0) return 0;
+    off_t pos = lseek(data_fd, 0, SEEK_CUR);
+    return pos > 0 ? pos : 0;
+#else
+    // Same contract as the driver, answered from the index without reading data
+    off_t pos = seglog_record_offset(seek_params->write_cmd, seek_params->write_cmd_offset);
+    return pos >= 0 ? pos : seglog_head();
+#endif
+}
+
+const char *store_mirror_at(off_t off, size_t *len) {
+    if (!__atomic_load_n(&mirror_on, __ATOMIC_ACQUIRE)) return NULL;
+    size_t end = __atomic_load_n(&mirror_len, __ATOMIC_ACQUIRE);
+    *len = (size_t)off < end ? end - off : 0;
+    return mirror + off;
+}
+
+void store_span_get(off_t *off, struct store_span *span) {
+#if USE_AESD_CHAR_DEVICE
+    // One device, the caller's end snapshot bounds the read
+    span->fd = data_fd;
+    span->file_off = *off;
+    span->len = SSIZE_MAX;
+    span->pin = NULL;
+#else
+    struct seglog_span s;
+    seglog_span_get(off, &s);
+    span->fd = s.fd;
+    span->file_off = s.file_off;
+    span->len = s.len;
+    span->pin = s.seg;
+#endif
+}
+
+void store_span_put(struct store_span *span) {
+#if !USE_AESD_CHAR_DEVICE
+    struct seglog_span s = { .seg = span->pin };
+    seglog_span_put(&s);
+#endif
+    span->pin = NULL;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file data-store.h
+ * @brief DATA_FILE backing store shared by every connection model
+ *
+ * The char device is opened once at startup; the regular file build keeps a
+ * segmented append log (seg-log.c) with optional retention.  Appends go
+ * through the store and replays read at explicit offsets, so connections never
+ * reopen DATA_FILE or share a file position.  With the regular file build the
+ * store can also keep a mirror of the contents in memory and serve replays
+ * from it.
+ *
+ * Offsets are store offsets: for the char device they are device positions,
+ * for the log they only grow, and store_head() is the oldest byte retained.
+ */
+
+#ifndef DATA_STORE_H
+#define DATA_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+// Contiguous stored bytes that can be read from one descriptor
+struct store_span {
+    int fd;
+    off_t file_off;     // where the bytes start in fd
+    size_t len;         // bytes available, 0 at the end of the data
+    void *pin;          // keeps a log segment alive until store_span_put()
+};
+
+struct store_config {
+    bool mirror;            // keep the regular file contents in memory and replay from it
+    bool sync;              // fdatasync() every group commit before its writers return
+    size_t retain_bytes;    // regular file log bound, 0 for unbounded
+    size_t retain_records;  // regular file log bound, 0 for unbounded
+};
+
+/**
+ * Open DATA_FILE, creating it if needed.  With cfg->mirror and a regular file
+ * build, existing contents are loaded into memory and every append is
+ * mirrored.  The retention bounds are ignored by the char device.
+ * @return 0 on success, -1 with errno set
+ */
+int store_open(const struct store_config *cfg);
+
+/**
+ * Release the store.  The regular file log is deleted, as the server always
+ * removed DATA_FILE on exit.
+ */
+void store_close(void);
+
+/**
+ * Append @p len bytes to DATA_FILE as one record, then to the mirror.
+ * Caller holds file_mutex.
+ * @return 0 on success, -1 if the write failed
+ */
+int store_append(const void *buf, size_t len);
+
+/**
+ * Append the @p iovcnt pieces of @p iov as one record through the group commit.  Concurrent
+ * callers queue up; whichever finds no commit running becomes the leader,
+ * takes file_mutex once and appends the whole queue with as few writev()
+ * calls (and, with cfg->sync, fdatasync() calls) as possible.  Returns once
+ * the record is written.  Caller must not hold file_mutex.
+ * @param head, end  the store range right after the group, for the replay
+ * @return 0 on success, -1 if the write failed
+ */
+int store_commit(const struct iovec *iov, int iovcnt, off_t *head, off_t *end);
+
+/**
+ * @return the offset of the oldest stored byte
+ */
+off_t store_head(void);
+
+/**
+ * @return the offset just past the newest stored byte.  Caller holds
+ * file_mutex, so the value is a consistent end point for a replay started
+ * under the same lock.
+ */
+off_t store_end(void);
+
+/**
+ * Resolve an AESDCHAR_IOCSEEKTO command: the driver's ioctl for the char
+ * device, the log index for the regular file.  Caller holds file_mutex.
+ * @return the replay start offset, store_head() if the command is out of range
+ */
+off_t store_seekto(const struct aesd_seekto *seek_params);
+
+/**
+ * @return a pointer to the mirrored bytes at @p off and their count in @p len,
+ * or NULL when there is no mirror.  Mirrored bytes never move or change, so
+ * the pointer stays valid until store_close() without holding any lock.
+ */
+const char *store_mirror_at(off_t off, size_t *len);
+
+/**
+ * Locate the stored bytes at *@p off; release with store_span_put().  If
+ * retention already dropped them, *@p off moves up to store_head().
+ */
+void store_span_get(off_t *off, struct store_span *span);
+void store_span_put(struct store_span *span);
+
+#endif /* DATA_STORE_H */
@@ -0,0 +1,62 @@
+/**
+ * @file hist.c
+ * @brief Log-linear (HDR style) latency histogram
+ *
+ * Values below 16 get a bucket each.  Above that, a value with its top bit
+ * at position e lands in row e, column given by the next four bits.
+ */
+
+#include "hist.h"
+
+#define SUB_BUCKETS (1 << HIST_SUB_BITS)
+
+static unsigned bucket_of(uint64_t v) {
+    if (v < SUB_BUCKETS) return v;
+    unsigned e = 63 - __builtin_clzll(v);
+    if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+    return (e - HIST_SUB_BITS + 1) * SUB_BUCKETS + ((v >> (e - HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+// Middle of the values that land in bucket @p b
+static uint64_t bucket_value(unsigned b) {
+    if (b < SUB_BUCKETS) return b;
+    unsigned e = b / SUB_BUCKETS + HIST_SUB_BITS - 1;
+    uint64_t low = (uint64_t)(SUB_BUCKETS + b % SUB_BUCKETS) << (e - HIST_SUB_BITS);
+    return low + ((uint64_t)1 << (e - HIST_SUB_BITS)) / 2;
+}
+
+void hist_record(struct hist *h, uint64_t v) {
+    __atomic_fetch_add(&h->buckets[bucket_of(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    // Single writer, a plain compare is enough
+    if (v > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+    }
+}
+
+void hist_merge(struct hist *dst, const struct hist *src) {
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max) dst->max = max;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        dst->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t hist_percentile(const struct hist *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(p * h->count);
+    if (rank >= h->count) rank = h->count - 1;
+
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) {
+            uint64_t v = bucket_value(b);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
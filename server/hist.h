@@ -0,0 +1,40 @@
+/**
+ * @file hist.h
+ * @brief Log-linear (HDR style) latency histogram
+ *
+ * 16 buckets per power of two, so a recorded value is known to within 1/16
+ * of itself, in a fixed 4.75 KB.  A histogram has a single writer; readers
+ * may merge it concurrently and see every field untorn.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+// Largest power of two tracked separately, about 18 minutes in nanoseconds
+#define HIST_MAX_EXP 40
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) << HIST_SUB_BITS)
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_record(struct hist *h, uint64_t v);
+
+/**
+ * Add @p src into @p dst.  Only @p dst must not change meanwhile.
+ */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/**
+ * @return the value below which a fraction @p p of the records fall, 0 for
+ * an empty histogram
+ */
+uint64_t hist_percentile(const struct hist *h, double p);
+
+#endif /* HIST_H */
@@ -0,0 +1,129 @@
+/**
+ * @file line-scan.c
+ * @brief Newline scanner used to split received bytes into packets
+ *
+ * The vector paths never read outside @p buf: AVX2 steps through aligned
+ * blocks and rescans the last 32 bytes for the tail, SSE2 leaves the tail to
+ * memchr().  The file is built with -O2 whatever the rest of the server uses,
+ * intrinsics are many times slower unoptimised.  The
+ * implementation is picked on first use and cached, every thread picks the
+ * same one so the race on the cache is harmless.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "line-scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#ifdef __SSE2__
+#define HAVE_SSE2 1
+#endif
+
+// Shorter runs are not worth setting up the vector compare for
+#define SCAN_MIN_VECTOR 32
+
+#ifdef HAVE_SSE2
+static const char *scan_sse2(const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) return buf + i + __builtin_ctz(mask);
+    }
+    return memchr(buf + i, '\n', len - i);
+}
+#endif
+
+__attribute__((target("avx2"), always_inline))
+static inline unsigned mask32(__m256i v) {
+    return _mm256_movemask_epi8(v);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const char *p = buf;
+    const char *end = buf + len;
+
+    if (len < 32) return memchr(buf, '\n', len);
+
+    // One unaligned block, then aligned ones; the overlap is scanned twice
+    unsigned mask = mask32(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+    if (mask) return p + __builtin_ctz(mask);
+    p = (const char *)(((uintptr_t)p + 32) & ~(uintptr_t)31);
+
+    // Four blocks per round with a single branch, packets are mostly long
+    for (; p + 128 <= end; p += 128) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), nl);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(p + 32)), nl);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(p + 64)), nl);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(p + 96)), nl);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(any, any)) {
+            if ((mask = mask32(a))) return p + __builtin_ctz(mask);
+            if ((mask = mask32(b))) return p + 32 + __builtin_ctz(mask);
+            if ((mask = mask32(c))) return p + 64 + __builtin_ctz(mask);
+            return p + 96 + __builtin_ctz(mask32(d));
+        }
+    }
+    for (; p + 32 <= end; p += 32) {
+        mask = mask32(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), nl));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    if (p == end) return NULL;
+
+    // Last partial block: reload the final 32 bytes, they all belong to buf
+    const char *last = end - 32;
+    mask = mask32(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)last), nl));
+    mask >>= p - last;
+    return mask ? p + __builtin_ctz(mask) : NULL;
+}
+#endif
+
+static const char *scan_memchr(const char *buf, size_t len) {
+    return memchr(buf, '\n', len);
+}
+
+typedef const char *(*scan_fn)(const char *buf, size_t len);
+
+static scan_fn scan_impl;
+static const char *scan_name;
+
+static scan_fn scan_pick(void) {
+    scan_fn fn = scan_memchr;
+    const char *name = "memchr";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fn = scan_avx2;
+        name = "avx2";
+    }
+#ifdef HAVE_SSE2
+    else {
+        fn = scan_sse2;
+        name = "sse2";
+    }
+#endif
+#endif
+    __atomic_store_n(&scan_name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&scan_impl, fn, __ATOMIC_RELAXED);
+    return fn;
+}
+
+const char *line_scan(const char *buf, size_t len) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (len < SCAN_MIN_VECTOR) return memchr(buf, '\n', len);
+#endif
+    scan_fn fn = __atomic_load_n(&scan_impl, __ATOMIC_RELAXED);
+    if (!fn) fn = scan_pick();
+    return fn(buf, len);
+}
+
+const char *line_scan_impl(void) {
+    scan_pick();
+    return __atomic_load_n(&scan_name, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,25 @@
+/**
+ * @file line-scan.h
+ * @brief Newline scanner used to split received bytes into packets
+ *
+ * On x86 the scan compares 32 (AVX2, if the CPU has it) or 16 (SSE2) bytes
+ * at a time and picks the first match from the comparison mask.  Other
+ * targets use memchr(), which the C library already vectorises where it can.
+ */
+
+#ifndef LINE_SCAN_H
+#define LINE_SCAN_H
+
+#include <stddef.h>
+
+/**
+ * @return the first '\n' in the @p len bytes at @p buf, or NULL
+ */
+const char *line_scan(const char *buf, size_t len);
+
+/**
+ * @return the name of the implementation line_scan() dispatches to
+ */
+const char *line_scan_impl(void);
+
+#endif /* LINE_SCAN_H */
@@ -0,0 +1,221 @@
+/**
+ * @file listeners.c
+ * @brief Listening sockets, optionally one SO_REUSEPORT listener per core
+ *
+ * Listener i is served by a loop pinned to the i-th CPU of the process
+ * affinity mask.  A classic BPF program on the reuseport group picks the
+ * listener from the CPU that received the SYN, so when the mask is CPUs
+ * 0..n-1 a connection is accepted and served on the CPU that took its
+ * packets.  Without the program (old kernels) the kernel hashes the
+ * 4-tuple instead, which still spreads the load.
+ */
+
+#define _GNU_SOURCE     // CPU_SET, pthread_attr_setaffinity_np
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include "aesdsocket.h"
+#include "listeners.h"
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+struct listener_loop {
+    pthread_t thread;
+    int fd;
+    int cpu;
+    enum server_model model;
+};
+
+static int listen_fds[LISTENERS_MAX];
+static int listen_count;
+
+// CPUs of the process affinity mask, in order
+static int cpu_list(int *cpus, int max) {
+    cpu_set_t set;
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus[n++] = cpu;
+        }
+    }
+    if (n == 0) cpus[n++] = 0;
+    return n;
+}
+
+int listeners_cpu_count(void) {
+    int cpus[LISTENERS_MAX];
+    return cpu_list(cpus, LISTENERS_MAX);
+}
+
+// --- Sockets ---
+
+static int listener_open(bool reuseport) {
+    struct sockaddr_in address;
+    int optval = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        goto fail;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(PORT);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) goto fail;
+    return fd;
+
+fail: {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+}
+
+// Steer each connection to the listener of the CPU that received it
+static void listeners_steer(void) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned)listen_count },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+    if (setsockopt(listen_fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        syslog(LOG_INFO, "No CPU steering for listeners, using the kernel hash: %s", strerror(errno));
+    }
+}
+
+int listeners_bind(int count) {
+    if (count < 1 || count > LISTENERS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (listen_count = 0; listen_count < count; listen_count++) {
+        int fd = listener_open(count > 1);
+        if (fd < 0) {
+            int err = errno;
+            listeners_close();
+            errno = err;
+            return -1;
+        }
+        listen_fds[listen_count] = fd;
+    }
+    server_fd = listen_fds[0];
+    return 0;
+}
+
+int listeners_listen(int backlog) {
+    if (listen_count > 1) listeners_steer();
+
+    // Sockets join the reuseport group in listen() order, which the steering relies on
+    for (int i = 0; i < listen_count; i++) {
+        if (listen(listen_fds[i], backlog) < 0) return -1;
+    }
+    return 0;
+}
+
+bool listeners_owns(int fd) {
+    for (int i = 0; i < listen_count; i++) {
+        if (listen_fds[i] == fd) return true;
+    }
+    return false;
+}
+
+void listeners_shutdown(void) {
+    for (int i = 0; i < listen_count; i++) shutdown(listen_fds[i], SHUT_RDWR);
+}
+
+void listeners_close(void) {
+    for (int i = 0; i < listen_count; i++) close(listen_fds[i]);
+    listen_count = 0;
+    server_fd = -1;
+}
+
+// --- Per-core loops ---
+
+static void *listener_loop_run(void *arg) {
+    struct listener_loop *l = arg;
+    int rc;
+
+    if (l->model == MODEL_URING) {
+        rc = uring_model_run(l->fd);
+        if (rc < 0 && errno == ENOSYS && !signal_caught) {
+            syslog(LOG_WARNING, "io_uring not supported, CPU %d falls back to epoll", l->cpu);
+            rc = reactor_run(l->fd);
+        }
+    } else {
+        rc = reactor_run(l->fd);
+    }
+    if (rc < 0) syslog(LOG_ERR, "Event loop on CPU %d failed: %s", l->cpu, strerror(errno));
+    return NULL;
+}
+
+int listeners_run(enum server_model model) {
+    int cpus[LISTENERS_MAX];
+    int ncpus = cpu_list(cpus, LISTENERS_MAX);
+    struct listener_loop *loops = calloc(listen_count, sizeof(*loops));
+    int started = 0;
+
+    if (!loops) return -1;
+
+    // Loops leave signals to the main thread, which wakes them through listeners_shutdown()
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (int i = 0; i < listen_count; i++) {
+        struct listener_loop *l = &loops[i];
+        pthread_attr_t attr;
+        cpu_set_t set;
+
+        l->fd = listen_fds[i];
+        l->cpu = cpus[i % ncpus];
+        l->model = model;
+
+        CPU_ZERO(&set);
+        CPU_SET(l->cpu, &set);
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        int err = pthread_create(&l->thread, &attr, listener_loop_run, l);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            syslog(LOG_ERR, "Could not start the loop for CPU %d: %s", l->cpu, strerror(err));
+            shutdown(l->fd, SHUT_RDWR);     // leaves the group, nobody would accept from it
+            l->fd = -1;
+            continue;
+        }
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    syslog(LOG_INFO, "Serving %d per-core listeners", started);
+
+    for (int i = 0; i < listen_count; i++) {
+        if (loops[i].fd >= 0) pthread_join(loops[i].thread, NULL);
+    }
+    free(loops);
+    if (started == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file listeners.h
+ * @brief Listening sockets, optionally one SO_REUSEPORT listener per core
+ *
+ * By default there is a single listener, server_fd, served by the selected
+ * connection model.  In per-core mode every CPU the process may run on gets
+ * its own listener bound to the same port, and its own event loop pinned to
+ * that CPU; the kernel spreads incoming connections over the listeners, so
+ * accepts neither queue behind one backlog nor serialize on one thread.
+ */
+
+#ifndef LISTENERS_H
+#define LISTENERS_H
+
+#include <stdbool.h>
+#include "aesdsocket.h"
+
+// listen() backlog unless -b says otherwise
+#define LISTEN_BACKLOG_DEFAULT 10
+#define LISTENERS_MAX 256
+
+/**
+ * @return the CPUs this process may run on, the default per-core listener count
+ */
+int listeners_cpu_count(void);
+
+/**
+ * Bind @p count listeners to PORT, with SO_REUSEPORT when there are several.
+ * The first one becomes server_fd.
+ * @return 0 on success, -1 with errno set
+ */
+int listeners_bind(int count);
+
+/**
+ * Start listening on every bound socket.
+ * @return 0 on success, -1 with errno set
+ */
+int listeners_listen(int backlog);
+
+/**
+ * @return true if @p fd is one of the listeners
+ */
+bool listeners_owns(int fd);
+
+/**
+ * Wake every loop blocked on a listener.  Async-signal-safe.
+ */
+void listeners_shutdown(void);
+
+void listeners_close(void);
+
+/**
+ * Serve each listener from its own thread pinned to a CPU, running the
+ * event loop of @p model (MODEL_EPOLL or MODEL_URING), until signal_caught
+ * is set.
+ * @return 0 on clean shutdown, -1 if no loop could be started
+ */
+int listeners_run(enum server_model model);
+
+#endif /* LISTENERS_H */
@@ -0,0 +1,197 @@
+/**
+ * @file out-queue.c
+ * @brief Per-connection queue of pending replies with backpressure
+ *
+ * The ring also pauses the connection at OUTQ_MAX_REPLIES entries: with a
+ * tiny store many replays fit under the byte watermark, and the ring itself
+ * must stay bounded too.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include "out-queue.h"
+#include "stats.h"
+
+#define OUTQ_MAX_REPLIES 4096
+
+static struct outq_limits limits = {
+    .high = OUTQ_DEFAULT_HIGH,
+    .low = OUTQ_DEFAULT_LOW,
+};
+
+void outq_configure(const struct outq_limits *l) {
+    limits = *l;
+}
+
+void outq_init(struct out_queue *q) {
+    replay_init(&q->cur);
+    q->cur_queued = 0;
+    q->msg = NULL;
+    q->msg_len = q->msg_sent = 0;
+    q->framed = false;
+    q->cur_mergeable = false;
+    q->ranges = NULL;
+    q->first = q->count = q->cap = 0;
+    q->queued = 0;
+    q->paused = false;
+}
+
+void outq_release(struct out_queue *q) {
+    replay_release(&q->cur);
+    free(q->msg);
+    for (unsigned i = 0; i < q->count; i++) free(q->ranges[(q->first + i) % q->cap].msg);
+    free(q->ranges);
+    outq_init(q);
+}
+
+static int outq_grow(struct out_queue *q) {
+    unsigned cap = q->cap ? q->cap * 2 : 8;
+    struct out_range *tmp = malloc(cap * sizeof(*tmp));
+    if (!tmp) return -1;
+
+    // Unwrap the ring while copying
+    for (unsigned i = 0; i < q->count; i++) tmp[i] = q->ranges[(q->first + i) % q->cap];
+    free(q->ranges);
+    q->ranges = tmp;
+    q->first = 0;
+    q->cap = cap;
+    return 0;
+}
+
+// Replace the newest waiting replay with @p r if @p r covers it
+static bool outq_merge(struct out_queue *q, const struct proto_reply *r) {
+    if (q->count > 0) {
+        struct out_range *last = &q->ranges[(q->first + q->count - 1) % q->cap];
+        if (!last->mergeable || r->off > last->off || r->end < last->end) return false;
+        q->queued += (r->end - r->off) - (last->end - last->off);
+        last->off = r->off;
+        last->end = r->end;
+        return true;
+    }
+    if (!q->cur_mergeable || !outq_pending(q) || r->off > q->cur.off || r->end < q->cur.end) {
+        return false;
+    }
+    q->cur.off = r->off;
+    q->cur.end = r->end;
+    return true;
+}
+
+int outq_push(struct out_queue *q, struct proto_reply *reply) {
+    if (reply->end < reply->off) reply->end = reply->off;
+    if (reply->end == reply->off && reply->msg_len == 0) {
+        free(reply->msg);
+        return 0;
+    }
+    if (reply->mergeable && reply->msg_len == 0 && outq_merge(q, reply)) {
+        stats_count(STAT_COALESCED, 1);
+        return 0;
+    }
+    uint64_t now = stats_now();
+
+    // Nothing in flight: start sending right away, the pipe is kept
+    if (!outq_pending(q)) {
+        free(q->msg);
+        q->msg = reply->msg;
+        q->msg_len = reply->msg_len;
+        q->msg_sent = 0;
+        q->framed = reply->framed;
+        q->cur_mergeable = reply->mergeable;
+        q->cur.off = reply->off;
+        q->cur.end = reply->end;
+        q->cur.skipped = 0;
+        q->cur_queued = now;
+        return 0;
+    }
+
+    if (q->count == q->cap && outq_grow(q) < 0) {
+        free(reply->msg);
+        return -1;
+    }
+    q->ranges[(q->first + q->count) % q->cap] = (struct out_range){
+        reply->off, reply->end, now, reply->msg, reply->msg_len, reply->framed, reply->mergeable,
+    };
+    q->count++;
+    q->queued += reply->msg_len + (reply->end - reply->off);
+    return 0;
+}
+
+size_t outq_bytes(const struct out_queue *q) {
+    size_t cur = q->cur.off < q->cur.end ? q->cur.end - q->cur.off : 0;
+    return (q->msg_len - q->msg_sent) + cur + q->queued;
+}
+
+bool outq_accepting(struct out_queue *q) {
+    size_t bytes = outq_bytes(q);
+
+    if (q->paused) {
+        if (bytes <= limits.low && q->count < OUTQ_MAX_REPLIES / 2) q->paused = false;
+    } else if (bytes >= limits.high || q->count >= OUTQ_MAX_REPLIES) {
+        q->paused = true;
+    }
+    return !q->paused;
+}
+
+bool outq_overrun(const struct out_queue *q) {
+    return limits.drop && q->count > 0 &&
+           (outq_bytes(q) > limits.high || q->count >= OUTQ_MAX_REPLIES);
+}
+
+// Send what is left of the message in front of cur
+static int outq_send_msg(struct out_queue *q, int sock) {
+    // With TCP_NODELAY a lone header would go out as its own segment
+    int flags = MSG_NOSIGNAL | (q->cur.off < q->cur.end ? MSG_MORE : 0);
+
+    while (q->msg_sent < q->msg_len) {
+        ssize_t s = send(sock, q->msg + q->msg_sent, q->msg_len - q->msg_sent, flags);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        q->msg_sent += s;
+        stats_count(STAT_BYTES_OUT, s);
+    }
+    return 1;
+}
+
+int outq_flush(struct out_queue *q, int sock) {
+    // Once sending starts cur is on the wire, a later reply can only queue behind it
+    q->cur_mergeable = false;
+    for (;;) {
+        if (q->msg_sent < q->msg_len) {
+            int rc = outq_send_msg(q, sock);
+            if (rc <= 0) return rc;
+        }
+        if (q->cur.off < q->cur.end) {
+            int rc = replay_send(&q->cur, sock);
+            if (rc <= 0) return rc;
+            // The store may have held less than the snapshot promised
+            if (q->framed && (q->cur.skipped > 0 || q->cur.off < q->cur.end)) {
+                syslog(LOG_INFO, "Dropping client, the store lost part of a framed reply");
+                return -1;
+            }
+            q->cur.off = q->cur.end;
+        }
+        // cur_queued is 0 once the reply it timed is recorded
+        if (q->cur_queued) stats_since(HIST_REPLAY, q->cur_queued);
+        q->cur_queued = 0;
+        free(q->msg);
+        q->msg = NULL;
+        q->msg_len = q->msg_sent = 0;
+        if (q->count == 0) return 1;
+
+        struct out_range *r = &q->ranges[q->first];
+        q->cur.off = r->off;
+        q->cur.end = r->end;
+        q->cur.skipped = 0;
+        q->cur_queued = r->queued;
+        q->msg = r->msg;
+        q->msg_len = r->msg_len;
+        q->framed = r->framed;
+        q->queued -= r->msg_len + (r->end - r->off);
+        q->first = (q->first + 1) % q->cap;
+        q->count--;
+    }
+}
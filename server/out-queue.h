@@ -0,0 +1,111 @@
+/**
+ * @file out-queue.h
+ * @brief Per-connection queue of pending replays with backpressure
+ *
+ * A replay is a range of the store, so queuing one costs a few bytes: the
+ * data itself stays in the shared store (mirror pages, page cache or the
+ * device) until the socket takes it.  The queue counts the bytes still owed
+ * to the client.  Once they reach the high watermark the connection stops
+ * taking packets, and with it stops reading, until the client has drained
+ * the queue down to the low watermark; with the drop policy a client that
+ * falls that far behind is disconnected instead.
+ *
+ * A binary reply (proto.h) adds its header, or a small payload built in
+ * memory, in front of the range.
+ *
+ * Replies stay in request order.  When the client opted in, a replay that
+ * covers the last one still waiting replaces it: the client gets the store
+ * once, as of its newest packet, instead of once per packet.
+ */
+
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "aesdsocket.h"
+#include "proto.h"
+
+#define OUTQ_DEFAULT_HIGH ((size_t)4 << 20)
+#define OUTQ_DEFAULT_LOW  ((size_t)1 << 20)
+
+struct outq_limits {
+    size_t high;        // stop taking packets at this many unsent bytes
+    size_t low;         // resume once the backlog is down to this
+    bool drop;          // disconnect a client that reaches high instead
+};
+
+struct out_range {
+    off_t off;
+    off_t end;
+    uint64_t queued;            // stats_now() at outq_push()
+    char *msg;                  // sent before the range, owned
+    size_t msg_len;
+    bool framed;
+    bool mergeable;
+};
+
+struct out_queue {
+    struct replay_ctx cur;      // replay being sent, cur.off == cur.end when idle
+    uint64_t cur_queued;        // when cur was queued
+    char *msg;                  // bytes to send ahead of cur, owned
+    size_t msg_len;
+    size_t msg_sent;
+    bool framed;                // cur must be sent whole, see proto_reply
+    bool cur_mergeable;         // cur may still be replaced, nothing of it sent yet
+    struct out_range *ranges;   // ring of replays waiting behind cur
+    unsigned first;
+    unsigned count;
+    unsigned cap;
+    size_t queued;              // bytes in ranges
+    bool paused;                // reached the high watermark, waiting for low
+};
+
+/**
+ * Set the watermarks for every queue.  Called once before serving clients.
+ */
+void outq_configure(const struct outq_limits *limits);
+
+void outq_init(struct out_queue *q);
+void outq_release(struct out_queue *q);
+
+/**
+ * Queue @p reply: its message, then the replay of its store range, unless
+ * it is mergeable and replaces the last reply waiting.  The queue takes the
+ * message over, even on failure.
+ * @return 0 on success, -1 if the ring could not grow
+ */
+int outq_push(struct out_queue *q, struct proto_reply *reply);
+
+/**
+ * @return the bytes still owed to the client
+ */
+size_t outq_bytes(const struct out_queue *q);
+
+static inline bool outq_pending(const struct out_queue *q) {
+    return q->msg_sent < q->msg_len || q->cur.off < q->cur.end || q->count > 0;
+}
+
+/**
+ * Apply the watermarks.
+ * @return true if the connection may take another packet
+ */
+bool outq_accepting(struct out_queue *q);
+
+/**
+ * @return true if the drop policy says the client is too far behind: past
+ * the high watermark with more than one replay outstanding
+ */
+bool outq_overrun(const struct out_queue *q);
+
+/**
+ * Send queued replies in order until the queue is empty or the socket would
+ * block.  The socket must be non-blocking.
+ * @return 1 when everything was sent, 0 on EAGAIN, -1 on error or when the
+ * store no longer holds all of a framed range
+ */
+int outq_flush(struct out_queue *q, int sock);
+
+#endif /* OUT_QUEUE_H */
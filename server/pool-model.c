@@ -0,0 +1,234 @@
+/**
+ * @file pool-model.c
+ * @brief Worker pool connection model for aesdsocket
+ *
+ * The main thread only accepts and waits for readiness.  It hands two kinds
+ * of jobs to a fixed size work-stealing pool (thread-pool.c):
+ *
+ *   connection job - set up the per-client session and register it
+ *   packet job     - drain a readable socket, committing every complete
+ *                    packet it finds, and send queued replays until the
+ *                    socket would block
+ *
+ * Client sockets are non-blocking and registered with EPOLLONESHOT, so at
+ * most one packet job per client is in flight and a session never needs its
+ * own lock.  Idle clients cost a session struct, and slow ones a queue of
+ * pending replays, not a thread.
+ */
+
+#define _GNU_SOURCE     // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include "aesdsocket.h"
+#include "thread-pool.h"
+#include "rx-buf.h"
+#include "out-queue.h"
+#include "stats.h"
+
+#define MAX_EVENTS 64
+// Packets handled per job before the session goes back to the dispatcher
+#define PACKETS_PER_JOB 16
+
+struct dispatcher;
+
+struct session {
+    int fd;
+    struct rx_buf rx;   // received bytes not yet committed
+    struct out_queue out;   // replays not yet sent
+    bool eof;           // client shut down its side, finish the replays
+    struct dispatcher *d;
+    LIST_ENTRY(session) entries;
+};
+
+struct dispatcher {
+    int epfd;
+    struct thread_pool *pool;
+    pthread_mutex_t lock;   // guards sessions
+    LIST_HEAD(session_list, session) sessions;
+};
+
+static void session_close(struct session *s) {
+    struct dispatcher *d = s->d;
+
+    pthread_mutex_lock(&d->lock);
+    LIST_REMOVE(s, entries);
+    pthread_mutex_unlock(&d->lock);
+
+    close(s->fd);
+    stats_conn_close();
+    outq_release(&s->out);
+    rx_buf_release(&s->rx);
+    free(s);
+}
+
+/**
+ * Re-arm the oneshot registration for whatever the session waits on: more
+ * packets while under the high watermark, writability while it owes replays
+ * or still has packets buffered from the last job.
+ */
+static bool session_arm(struct session *s, int op, bool more) {
+    struct epoll_event ev = {
+        .events = EPOLLONESHOT,
+        .data.ptr = s,
+    };
+    if (!s->eof && outq_accepting(&s->out)) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (more || outq_pending(&s->out)) ev.events |= EPOLLOUT;
+    return epoll_ctl(s->d->epfd, op, s->fd, &ev) == 0;
+}
+
+// Packet job: runs on a worker with exclusive ownership of the session
+static void session_read_job(void *arg) {
+    struct session *s = arg;
+    int packets = 0;
+
+    while (packets < PACKETS_PER_JOB) {
+        int served = serve_packets(&s->rx, &s->out, PACKETS_PER_JOB - packets);
+        if (served < 0) goto close_session;
+        packets += served;
+
+        int rc = outq_flush(&s->out, s->fd);
+        if (rc < 0) goto close_session;
+        if (rc == 1 && served > 0) continue;    // drained, packets held back may go now
+        if (s->eof) {
+            if (rc == 1) goto close_session;
+            break;
+        }
+        // Over the high watermark: leave the socket alone until the client catches up
+        if (!outq_accepting(&s->out)) break;
+
+        size_t room;
+        char *space = rx_buf_space(&s->rx, &room);
+        if (!space) goto close_session;
+
+        uint64_t t = stats_now();
+        ssize_t n = recv(s->fd, space, room, 0);
+        stats_since(HIST_RECV, t);
+        if (n > 0) {
+            stats_count(STAT_BYTES_IN, n);
+            rx_buf_added(&s->rx, n);
+            continue;
+        }
+        if (n == 0) {
+            s->eof = true;  // still owe the replays already queued
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        goto close_session;
+    }
+
+    // Drained, blocked or out of turns; a job that used up its turn may have
+    // packets left in the buffer, EPOLLOUT brings it straight back
+    if (session_arm(s, EPOLL_CTL_MOD, packets >= PACKETS_PER_JOB)) return;
+
+close_session:
+    session_close(s);
+}
+
+// Connection job: build the session for a freshly accepted client
+static void session_open_job(void *arg) {
+    struct session *s = arg;
+    struct dispatcher *d = s->d;
+
+    rx_buf_init(&s->rx);
+    outq_init(&s->out);
+
+    pthread_mutex_lock(&d->lock);
+    LIST_INSERT_HEAD(&d->sessions, s, entries);
+    pthread_mutex_unlock(&d->lock);
+
+    if (!session_arm(s, EPOLL_CTL_ADD, false)) session_close(s);
+}
+
+static void dispatcher_accept(struct dispatcher *d, int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+
+        client_socket_init(fd);
+        stats_conn_open();
+        struct session *s = calloc(1, sizeof(*s));
+        if (!s) {
+            close(fd);
+            stats_conn_close();
+            continue;
+        }
+        s->fd = fd;
+        s->d = d;
+        if (thread_pool_submit(d->pool, session_open_job, s) < 0) {
+            close(fd);
+            free(s);
+            stats_conn_close();
+        }
+    }
+}
+
+int pool_model_run(int listen_fd, int nworkers) {
+    struct dispatcher d;
+    struct epoll_event events[MAX_EVENTS];
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (d.epfd < 0) return -1;
+
+    // A NULL data pointer marks the listening socket
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(d.epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        close(d.epfd);
+        return -1;
+    }
+
+    d.pool = thread_pool_create(nworkers);
+    if (!d.pool) {
+        close(d.epfd);
+        return -1;
+    }
+    pthread_mutex_init(&d.lock, NULL);
+    LIST_INIT(&d.sessions);
+    syslog(LOG_INFO, "Worker pool started with %d threads", nworkers);
+
+    while (!signal_caught) {
+        int n = epoll_wait(d.epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct session *s = events[i].data.ptr;
+            if (s == NULL) {
+                dispatcher_accept(&d, listen_fd);
+            } else if (thread_pool_submit(d.pool, session_read_job, s) < 0) {
+                session_close(s);
+            }
+        }
+    }
+
+    // Cut every session short so the jobs still running finish and the pool can drain
+    pthread_mutex_lock(&d.lock);
+    struct session *s;
+    LIST_FOREACH(s, &d.sessions, entries) shutdown(s->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&d.lock);
+
+    thread_pool_destroy(d.pool);
+
+    while (!LIST_EMPTY(&d.sessions)) session_close(LIST_FIRST(&d.sessions));
+    pthread_mutex_destroy(&d.lock);
+    close(d.epfd);
+    return 0;
+}
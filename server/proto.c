@@ -0,0 +1,274 @@
+/**
+ * @file proto.c
+ * @brief Wire protocols: newline packets and length-prefixed binary frames
+ *
+ * Text requests go through commit_packet() as they always did.  Binary
+ * requests are decoded here and run through the same commit_append() and
+ * commit_seekto(); only the replies differ, a header built in memory in
+ * front of the store range the text protocol would have replayed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "aesdsocket.h"
+#include "data-store.h"
+#include "rx-buf.h"
+#include "proto.h"
+#include "stats.h"
+
+// Iovecs kept on the stack for an append, more than this are allocated
+#define APPEND_IOV 16
+// Longest payload of the fixed-size requests, READ's
+#define SMALL_PAYLOAD 16
+
+// The HELLO request, which is also how a binary client announces itself
+static const unsigned char hello[PROTO_HDR_LEN + sizeof(PROTO_HELLO_MAGIC) - 1] = {
+    PROTO_OP_HELLO, 0, 0, 0, 0, 0, 0, sizeof(PROTO_HELLO_MAGIC) - 1,
+    'A', 'E', 'S', 'D', 'B', 'I', 'N', '1',
+};
+
+static uint32_t get_u32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return be64toh(v);
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+// --- Framing ---
+
+ssize_t proto_frame(struct rx_buf *rx) {
+    if (rx->proto == PROTO_UNKNOWN) {
+        unsigned char head[sizeof(hello)];
+        size_t n = rx_buf_peek(rx, head, sizeof(head));
+        if (n == 0) return 0;
+        if (memcmp(head, hello, n) != 0) {
+            rx->proto = PROTO_TEXT;
+        } else if (n == sizeof(hello)) {
+            rx->proto = PROTO_BINARY;
+        } else {
+            return 0;
+        }
+    }
+    if (rx->proto == PROTO_TEXT) return rx_buf_frame(rx);
+
+    unsigned char hdr[PROTO_HDR_LEN];
+    if (rx_buf_peek(rx, hdr, sizeof(hdr)) < sizeof(hdr)) return 0;
+    uint32_t len = get_u32(hdr + 4);
+    if (len > PROTO_MAX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return rx->len >= PROTO_HDR_LEN + len ? PROTO_HDR_LEN + len : 0;
+}
+
+// --- Binary requests ---
+
+/**
+ * Build a reply header announcing @p len payload bytes, followed by the
+ * @p extra bytes of @p payload that are sent from memory.
+ */
+static int reply_msg(struct proto_reply *r, uint8_t op, uint8_t status, uint32_t len,
+                     const void *payload, size_t extra) {
+    unsigned char *msg = malloc(PROTO_HDR_LEN + extra);
+    if (!msg) return -1;
+    msg[0] = op;
+    msg[1] = status;
+    msg[2] = msg[3] = 0;
+    put_u32(msg + 4, len);
+    if (extra) memcpy(msg + PROTO_HDR_LEN, payload, extra);
+    r->msg = (char *)msg;
+    r->msg_len = PROTO_HDR_LEN + extra;
+    return 0;
+}
+
+static int reply_status(struct proto_reply *r, uint8_t op, uint8_t status) {
+    return reply_msg(r, op, status, 0, NULL, 0);
+}
+
+// A store range as the payload, cut to what a frame can announce
+static int reply_range(struct proto_reply *r, uint8_t op, off_t off, off_t end) {
+    if (end < off) end = off;
+    if (end - off > UINT32_MAX) end = off + UINT32_MAX;
+    r->off = off;
+    r->end = end;
+    r->framed = true;
+    return reply_msg(r, op, PROTO_OK, end - off, NULL, 0);
+}
+
+// Drop the first @p n bytes described by @p iov
+static void iov_skip(struct iovec **iov, int *iovcnt, size_t n) {
+    while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0) {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+static int serve_append(struct iovec *iov, int iovcnt, size_t len, struct proto_reply *r) {
+    struct iovec local[APPEND_IOV];
+    struct iovec *rec = local;
+    int cnt = iovcnt;
+    off_t head, end;
+
+    if (len == 0) return reply_status(r, PROTO_OP_APPEND, PROTO_E_INVALID);
+
+    // Terminate the record so it reads back as one
+    const struct iovec *last = &iov[iovcnt - 1];
+    bool newline = ((const char *)last->iov_base)[last->iov_len - 1] == '\n';
+    if (!newline) cnt++;
+    if (cnt > APPEND_IOV) {
+        rec = malloc(cnt * sizeof(*rec));
+        if (!rec) return reply_status(r, PROTO_OP_APPEND, PROTO_E_NOMEM);
+    }
+    memcpy(rec, iov, iovcnt * sizeof(*rec));
+    if (!newline) rec[iovcnt] = (struct iovec){ .iov_base = "\n", .iov_len = 1 };
+
+    int rc = commit_append(rec, cnt, &head, &end);
+    if (rec != local) free(rec);
+    if (rc < 0) return reply_status(r, PROTO_OP_APPEND, PROTO_E_STORE);
+
+    unsigned char ack[16];
+    put_u64(ack, head);
+    put_u64(ack + 8, end);
+    return reply_msg(r, PROTO_OP_APPEND, PROTO_OK, sizeof(ack), ack, sizeof(ack));
+}
+
+static int serve_seekto(const unsigned char *p, size_t len, struct proto_reply *r) {
+    struct aesd_seekto seek_params;
+    off_t off, end;
+
+    if (len != 8) return reply_status(r, PROTO_OP_SEEKTO, PROTO_E_INVALID);
+    seek_params.write_cmd = get_u32(p);
+    seek_params.write_cmd_offset = get_u32(p + 4);
+    commit_seekto(&seek_params, &off, &end);
+    return reply_range(r, PROTO_OP_SEEKTO, off, end);
+}
+
+static int serve_read(const unsigned char *p, size_t len, struct proto_reply *r) {
+    if (len != 16) return reply_status(r, PROTO_OP_READ, PROTO_E_INVALID);
+    uint64_t want_off = get_u64(p);
+    uint64_t want_len = get_u64(p + 8);
+
+    uint64_t locked = stats_mutex_lock(&file_mutex);
+    off_t head = store_head();
+    off_t end = store_end();
+    stats_mutex_unlock(&file_mutex, locked);
+
+    off_t off = want_off > (uint64_t)end ? end : (off_t)want_off;
+    if (off < head) off = head;
+    if (want_len > 0 && want_len < (uint64_t)(end - off)) end = off + want_len;
+    return reply_range(r, PROTO_OP_READ, off, end);
+}
+
+static int serve_stats(const unsigned char *p, size_t len, struct proto_reply *r) {
+    size_t report_len;
+    char *report = stats_report(len >= 4 && memcmp(p, "json", 4) == 0, &report_len);
+    if (!report) return reply_status(r, PROTO_OP_STATS, PROTO_E_NOMEM);
+
+    int rc = reply_msg(r, PROTO_OP_STATS, PROTO_OK, report_len, report, report_len);
+    free(report);
+    return rc;
+}
+
+static int serve_frame(struct rx_buf *rx, size_t len, struct proto_reply *r) {
+    // Every request but APPEND has a few bytes of payload: decode it from a flat copy
+    unsigned char flat[PROTO_HDR_LEN + SMALL_PAYLOAD];
+    size_t payload_len = len - PROTO_HDR_LEN;
+    size_t n = payload_len < SMALL_PAYLOAD ? payload_len : SMALL_PAYLOAD;
+    const unsigned char *payload = flat + PROTO_HDR_LEN;
+
+    rx_buf_peek(rx, flat, PROTO_HDR_LEN + n);
+    uint8_t op = flat[0];
+    stats_count(STAT_FRAMES, 1);
+
+    switch (op) {
+    case PROTO_OP_HELLO: {
+        if (payload_len != sizeof(PROTO_HELLO_MAGIC) - 1 || memcmp(payload, PROTO_HELLO_MAGIC, payload_len) != 0) {
+            return reply_status(r, op, PROTO_E_INVALID);
+        }
+        unsigned char info[8];
+        put_u32(info, PROTO_VERSION);
+        put_u32(info + 4, PROTO_MAX_PAYLOAD);
+        return reply_msg(r, op, PROTO_OK, sizeof(info), info, sizeof(info));
+    }
+    case PROTO_OP_APPEND: {
+        struct iovec *iov;
+        int iovcnt = rx_buf_iov(rx, len, &iov);
+        if (iovcnt < 0) return -1;
+        iov_skip(&iov, &iovcnt, PROTO_HDR_LEN);
+        return serve_append(iov, iovcnt, payload_len, r);
+    }
+    case PROTO_OP_SEEKTO:
+        return serve_seekto(payload, payload_len, r);
+    case PROTO_OP_READ:
+        return serve_read(payload, payload_len, r);
+    case PROTO_OP_STATS:
+        return serve_stats(payload, n, r);
+    default:
+        return reply_status(r, op, PROTO_E_OPCODE);
+    }
+}
+
+// --- Text requests ---
+
+// "AESDCHAR_COALESCE:0|1", checked on the first bytes only
+static bool parse_coalesce(const struct iovec *iov, int iovcnt, bool *on) {
+    static const char cmd[] = "AESDCHAR_COALESCE:";
+    char head[sizeof(cmd) + 1];
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt && len < sizeof(head); i++) {
+        size_t n = iov[i].iov_len;
+        if (n > sizeof(head) - len) n = sizeof(head) - len;
+        memcpy(head + len, iov[i].iov_base, n);
+        len += n;
+    }
+    // The digit, then the newline ending the packet
+    if (len < sizeof(head) || memcmp(head, cmd, sizeof(cmd) - 1) != 0) return false;
+    if (head[sizeof(head) - 1] != '\n') return false;
+    char v = head[sizeof(cmd) - 1];
+    if (v != '0' && v != '1') return false;
+    *on = v == '1';
+    return true;
+}
+
+int proto_serve(struct rx_buf *rx, size_t len, struct proto_reply *reply) {
+    int rc = 0;
+
+    memset(reply, 0, sizeof(*reply));
+    if (rx->proto == PROTO_TEXT) {
+        struct iovec *iov;
+        int iovcnt = rx_buf_iov(rx, len, &iov);
+        if (iovcnt < 0) return -1;
+        if (!parse_coalesce(iov, iovcnt, &rx->coalesce)) {
+            commit_packet(iov, iovcnt, &reply->off, &reply->end);
+            reply->mergeable = rx->coalesce;
+        }
+    } else {
+        rc = serve_frame(rx, len, reply);
+    }
+    rx_buf_consume(rx, len);
+    return rc;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file proto.h
+ * @brief Wire protocols: newline packets and length-prefixed binary frames
+ *
+ * A connection speaks the newline protocol unless its first bytes are the
+ * binary HELLO frame below, so existing text clients keep working.  A
+ * binary client is never scanned for newlines: every frame announces its
+ * own length.
+ *
+ * Every frame, in either direction, starts with an 8 byte header, integers
+ * in network byte order:
+ *
+ *   u8 opcode | u8 status (0 in requests) | u16 reserved (0) | u32 length
+ *
+ * followed by length payload bytes.  Each request gets exactly one reply
+ * with the same opcode, in request order:
+ *
+ *   HELLO   "AESDBIN1"              -> u32 version, u32 largest request payload
+ *   APPEND  record bytes            -> u64 store head, u64 store end after the commit
+ *   SEEKTO  u32 cmd, u32 cmd offset -> the store from the seek position, as the
+ *                                      text seek command replays it
+ *   READ    u64 offset, u64 length  -> the stored bytes from offset (moved up to
+ *                                      the oldest retained byte), at most length
+ *                                      of them, 0 for up to the end
+ *   STATS   "json" or nothing       -> the stats report (stats.h)
+ *
+ * Records stay newline terminated so text clients, the char driver and
+ * seek commands see the same records: APPEND adds a newline to a payload
+ * that does not end in one.  A reply with a non-zero status has no payload.
+ * Text clients may send "AESDCHAR_COALESCE:1" (":0" to turn it off again)
+ * to say they only need the store as of their latest packet: a queued
+ * replay that a later one covers is then dropped instead of sent.  The
+ * command is not stored and gets no reply.
+ *
+ * A request longer than PROTO_MAX_PAYLOAD gets the connection closed, and
+ * so does a SEEKTO or READ reply if retention drops its bytes before they
+ * are sent: its header already promised them.
+ */
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PROTO_VERSION 1
+#define PROTO_HDR_LEN 8
+#define PROTO_HELLO_MAGIC "AESDBIN1"
+#define PROTO_MAX_PAYLOAD ((uint32_t)16 << 20)
+
+// Protocol of a connection, kept in its rx_buf
+enum proto_kind {
+    PROTO_UNKNOWN = 0,      // too few bytes yet to tell
+    PROTO_TEXT,
+    PROTO_BINARY,
+};
+
+enum proto_opcode {
+    PROTO_OP_HELLO = 0,
+    PROTO_OP_APPEND = 1,
+    PROTO_OP_SEEKTO = 2,
+    PROTO_OP_READ = 3,
+    PROTO_OP_STATS = 4,
+};
+
+enum proto_status {
+    PROTO_OK = 0,
+    PROTO_E_OPCODE = 1,     // unknown opcode
+    PROTO_E_INVALID = 2,    // payload malformed for the opcode
+    PROTO_E_STORE = 3,      // the store could not take the record
+    PROTO_E_NOMEM = 4,      // no memory to build the reply
+};
+
+struct rx_buf;
+
+// What to send back for one request: msg (owned, may be NULL), then the store range
+struct proto_reply {
+    char *msg;
+    size_t msg_len;
+    off_t off;
+    off_t end;
+    bool framed;        // the range is a frame payload: it must go out whole or not at all
+    bool mergeable;     // a later reply covering the range may replace it
+};
+
+/**
+ * Find the next request buffered in @p rx, settling the connection's
+ * protocol from its first bytes.
+ * @return the request length, 0 if none is complete yet, -1 if the client
+ * must be dropped (oversized binary frame)
+ */
+ssize_t proto_frame(struct rx_buf *rx);
+
+/**
+ * Carry out the request of @p len bytes at the head of @p rx and consume it.
+ * @return 0 with @p reply filled in, -1 if the buffer could not be read
+ */
+int proto_serve(struct rx_buf *rx, size_t len, struct proto_reply *reply);
+
+#endif /* PROTO_H */
@@ -0,0 +1,188 @@
+/**
+ * @file reactor.c
+ * @brief Edge-triggered epoll event loop for aesdsocket
+ *
+ * Every client socket is non-blocking.  Each line received is committed as
+ * a packet and its replay queued on the connection's out_queue; the queue is
+ * sent as the socket drains while reading carries on, up to the high
+ * watermark.  Bytes after the last newline are carried forward into the next
+ * packet.
+ *
+ * Sockets are registered once for EPOLLIN|EPOLLOUT in edge-triggered mode, so
+ * each wakeup drives the connection until the kernel reports EAGAIN.
+ */
+
+#define _GNU_SOURCE     // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include "aesdsocket.h"
+#include "rx-buf.h"
+#include "out-queue.h"
+#include "stats.h"
+
+#define MAX_EVENTS 64
+
+struct conn {
+    int fd;
+    struct rx_buf rx;           // received bytes not yet committed
+    struct out_queue out;       // replays not yet sent
+    bool eof;                   // client shut down its side, finish the replays
+    LIST_ENTRY(conn) entries;
+};
+
+struct reactor {
+    int epfd;
+    int listen_fd;
+    LIST_HEAD(conn_list, conn) conns;
+};
+
+static void conn_free(struct conn *c) {
+    LIST_REMOVE(c, entries);
+    outq_release(&c->out);
+    close(c->fd);  // also drops the epoll registration
+    stats_conn_close();
+    rx_buf_release(&c->rx);
+    free(c);
+}
+
+/**
+ * Receive what the socket has, unless the client is over its high watermark.
+ * @return 1 when bytes or EOF came in, 0 on EAGAIN, -1 when the connection is done
+ */
+static int conn_recv(struct conn *c) {
+    for (;;) {
+        size_t room;
+        char *space = rx_buf_space(&c->rx, &room);
+        if (!space) return -1;
+
+        uint64_t t = stats_now();
+        ssize_t n = recv(c->fd, space, room, 0);
+        stats_since(HIST_RECV, t);
+        if (n > 0) {
+            stats_count(STAT_BYTES_IN, n);
+            rx_buf_added(&c->rx, n);
+            return 1;
+        }
+        if (n == 0) {
+            c->eof = true;  // still owe the replays already queued
+            return 1;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
+}
+
+/**
+ * Commit buffered packets, send queued replays and read more, until the
+ * socket would block in the direction that matters.  No lock is held past a
+ * commit; replays are streamed as the socket drains.
+ * @return false when the connection should be closed
+ */
+static bool conn_drive(struct conn *c) {
+    for (;;) {
+        int served = serve_packets(&c->rx, &c->out, INT_MAX);
+        if (served < 0) return false;
+        int rc = outq_flush(&c->out, c->fd);
+        if (rc < 0) return false;
+        if (rc == 1 && served > 0) continue;    // drained, packets held back may go now
+        if (c->eof) return rc == 0;
+
+        // Over the high watermark the next EPOLLOUT edge resumes reading
+        if (!outq_accepting(&c->out)) return true;
+
+        int r = conn_recv(c);
+        if (r <= 0) return r == 0;
+    }
+}
+
+static void reactor_accept(struct reactor *r) {
+    for (;;) {
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && !signal_caught) {
+                syslog(LOG_ERR, "accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        client_socket_init(fd);
+        stats_conn_open();
+        struct conn *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            stats_conn_close();
+            continue;
+        }
+        c->fd = fd;
+        rx_buf_init(&c->rx);
+        outq_init(&c->out);
+        LIST_INSERT_HEAD(&r->conns, c, entries);
+
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = c,
+        };
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            conn_free(c);
+            continue;
+        }
+
+        // Data may have arrived before registration; edge triggering would miss it
+        if (!conn_drive(c)) conn_free(c);
+    }
+}
+
+int reactor_run(int listen_fd) {
+    struct reactor r;
+    struct epoll_event events[MAX_EVENTS];
+
+    r.listen_fd = listen_fd;
+    LIST_INIT(&r.conns);
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    r.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r.epfd < 0) return -1;
+
+    // A NULL data pointer marks the listening socket
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(r.epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        close(r.epfd);
+        return -1;
+    }
+
+    while (!signal_caught) {
+        int n = epoll_wait(r.epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct conn *c = events[i].data.ptr;
+            if (c == NULL) {
+                reactor_accept(&r);
+            } else if (!conn_drive(c)) {
+                conn_free(c);
+            }
+        }
+    }
+
+    while (!LIST_EMPTY(&r.conns)) conn_free(LIST_FIRST(&r.conns));
+    close(r.epfd);
+    return 0;
+}
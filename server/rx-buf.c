@@ -0,0 +1,184 @@
+/**
+ * @file rx-buf.c
+ * @brief Chained receive buffers built from recycled fixed-size chunks
+ *
+ * Framing scans each byte once: rx_buf_frame() remembers how far it got and
+ * only the rest is handed to line_scan().
+ *
+ * The free list is a plain LIFO under a mutex: a chunk that was just released
+ * is the one most likely to still be in cache.  It keeps at most
+ * RX_POOL_MAX chunks so a burst of large packets does not pin memory for good.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rx-buf.h"
+#include "line-scan.h"
+
+#define RX_POOL_MAX 1024
+
+struct rx_chunk {
+    struct rx_chunk *next;
+    size_t used;            // bytes received into data
+    char data[];
+};
+
+#define RX_CHUNK_DATA (RX_CHUNK_SIZE - offsetof(struct rx_chunk, data))
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rx_chunk *pool;
+static size_t pool_count;
+
+// --- Chunk pool ---
+
+static struct rx_chunk *chunk_get(void) {
+    pthread_mutex_lock(&pool_lock);
+    struct rx_chunk *c = pool;
+    if (c) {
+        pool = c->next;
+        pool_count--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!c) c = malloc(RX_CHUNK_SIZE);
+    if (c) {
+        c->next = NULL;
+        c->used = 0;
+    }
+    return c;
+}
+
+static void chunk_put(struct rx_chunk *c) {
+    pthread_mutex_lock(&pool_lock);
+    bool keep = pool_count < RX_POOL_MAX;
+    if (keep) {
+        c->next = pool;
+        pool = c;
+        pool_count++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (!keep) free(c);
+}
+
+// --- Buffer ---
+
+void rx_buf_init(struct rx_buf *rb) {
+    memset(rb, 0, sizeof(*rb));
+}
+
+void rx_buf_release(struct rx_buf *rb) {
+    while (rb->head) {
+        struct rx_chunk *next = rb->head->next;
+        chunk_put(rb->head);
+        rb->head = next;
+    }
+    free(rb->iov);
+    rx_buf_init(rb);
+}
+
+char *rx_buf_space(struct rx_buf *rb, size_t *room) {
+    if (!rb->tail || rb->tail->used == RX_CHUNK_DATA) {
+        struct rx_chunk *c = chunk_get();
+        if (!c) return NULL;
+        if (rb->tail) {
+            rb->tail->next = c;
+        } else {
+            rb->head = c;
+        }
+        rb->tail = c;
+    }
+    *room = RX_CHUNK_DATA - rb->tail->used;
+    return rb->tail->data + rb->tail->used;
+}
+
+void rx_buf_added(struct rx_buf *rb, size_t n) {
+    rb->tail->used += n;
+    rb->len += n;
+}
+
+size_t rx_buf_frame(struct rx_buf *rb) {
+    if (!rb->scan_chunk) {
+        rb->scan_chunk = rb->head;
+        rb->scan_off = rb->start;
+    }
+
+    // Resume where the last call stopped, no byte is looked at twice
+    while (rb->scanned < rb->len) {
+        struct rx_chunk *c = rb->scan_chunk;
+        if (rb->scan_off == c->used) {
+            rb->scan_chunk = c->next;
+            rb->scan_off = 0;
+            continue;
+        }
+
+        const char *from = c->data + rb->scan_off;
+        size_t n = c->used - rb->scan_off;
+        const char *nl = line_scan(from, n);
+        if (nl) n = nl - from + 1;
+        rb->scanned += n;
+        rb->scan_off += n;
+        if (nl) return rb->scanned;
+    }
+    return 0;
+}
+
+size_t rx_buf_peek(const struct rx_buf *rb, void *dst, size_t len) {
+    size_t copied = 0;
+    size_t off = rb->start;
+
+    if (len > rb->len) len = rb->len;
+    for (struct rx_chunk *c = rb->head; copied < len; c = c->next, off = 0) {
+        size_t n = c->used - off;
+        if (n > len - copied) n = len - copied;
+        memcpy((char *)dst + copied, c->data + off, n);
+        copied += n;
+    }
+    return copied;
+}
+
+int rx_buf_iov(struct rx_buf *rb, size_t len, struct iovec **iov) {
+    int cnt = 0;
+    size_t off = rb->start;
+
+    for (struct rx_chunk *c = rb->head; len > 0; c = c->next, off = 0) {
+        if (cnt == rb->iov_cap) {
+            int cap = rb->iov_cap ? rb->iov_cap * 2 : 4;
+            struct iovec *tmp = realloc(rb->iov, cap * sizeof(*tmp));
+            if (!tmp) return -1;
+            rb->iov = tmp;
+            rb->iov_cap = cap;
+        }
+        size_t n = c->used - off;
+        if (n > len) n = len;
+        rb->iov[cnt].iov_base = c->data + off;
+        rb->iov[cnt].iov_len = n;
+        cnt++;
+        len -= n;
+    }
+    *iov = rb->iov;
+    return cnt;
+}
+
+void rx_buf_consume(struct rx_buf *rb, size_t len) {
+    rb->len -= len;
+    len += rb->start;
+    while (rb->head && len >= rb->head->used && rb->head != rb->tail) {
+        struct rx_chunk *next = rb->head->next;
+        len -= rb->head->used;
+        chunk_put(rb->head);
+        rb->head = next;
+    }
+    rb->start = len;
+
+    // Nothing left: rewind the remaining chunk rather than trade it in
+    if (rb->len == 0 && rb->head) {
+        rb->head->used = 0;
+        rb->start = 0;
+    }
+
+    // The next frame is scanned from the new start
+    rb->scan_chunk = NULL;
+    rb->scanned = 0;
+}
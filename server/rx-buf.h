@@ -0,0 +1,82 @@
+/**
+ * @file rx-buf.h
+ * @brief Chained receive buffers built from recycled fixed-size chunks
+ *
+ * A connection receives into a chain of RX_CHUNK_SIZE chunks.  A packet that
+ * outgrows one chunk takes another from a process wide free list instead of
+ * being reallocated, and is committed as an iovec over the chain.  Consumed
+ * chunks go back to the free list for any connection to reuse; nothing is
+ * ever cleared, bytes past the buffered length are simply never looked at.
+ */
+
+#ifndef RX_BUF_H
+#define RX_BUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define RX_CHUNK_SIZE 4096
+
+struct rx_chunk;
+
+struct rx_buf {
+    struct rx_chunk *head;  // oldest chunk, holds the start of the next packet
+    struct rx_chunk *tail;  // chunk receiving new bytes
+    size_t start;           // first unconsumed byte in head
+    size_t len;             // unconsumed bytes across the chain
+    struct rx_chunk *scan_chunk;    // where rx_buf_frame() resumes, NULL for start
+    size_t scan_off;
+    size_t scanned;         // bytes from start known to hold no newline
+    struct iovec *iov;      // scratch for rx_buf_iov(), grows with the chain
+    int iov_cap;
+    int proto;              // enum proto_kind, settled by proto_frame()
+    bool coalesce;          // the client opted into merged replays (proto.h)
+};
+
+void rx_buf_init(struct rx_buf *rb);
+
+/**
+ * Return every chunk to the free list and drop the iovec scratch.
+ */
+void rx_buf_release(struct rx_buf *rb);
+
+/**
+ * @return where the next recv may write, with its size in @p room, or NULL
+ * if no chunk could be had
+ */
+char *rx_buf_space(struct rx_buf *rb, size_t *room);
+
+/**
+ * Account for @p n bytes received into rx_buf_space().
+ */
+void rx_buf_added(struct rx_buf *rb, size_t n);
+
+/**
+ * Find the next packet.  Several may be buffered after one recv; consume each
+ * with rx_buf_consume() before asking for the next.
+ * @return the length of the buffered data through its first newline, 0 if no
+ * complete packet is buffered yet
+ */
+size_t rx_buf_frame(struct rx_buf *rb);
+
+/**
+ * Copy up to @p len bytes from the start of the buffer to @p dst, leaving
+ * them buffered.
+ * @return the number of bytes copied
+ */
+size_t rx_buf_peek(const struct rx_buf *rb, void *dst, size_t len);
+
+/**
+ * Describe the first @p len buffered bytes.
+ * @return the iovec count and the array in @p iov (valid until the buffer
+ * changes), or -1 if the scratch array could not grow
+ */
+int rx_buf_iov(struct rx_buf *rb, size_t len, struct iovec **iov);
+
+/**
+ * Drop the first @p len buffered bytes, recycling chunks they free up.
+ */
+void rx_buf_consume(struct rx_buf *rb, size_t len);
+
+#endif /* RX_BUF_H */
@@ -0,0 +1,108 @@
+/**
+ * @file scan-bench.c
+ * @brief Microbenchmark for the newline scanner used by packet framing
+ *
+ * For each packet size, scans a buffer of back to back packets the way
+ * rx_buf_frame() does (one line_scan() call per packet) and compares it with
+ * a byte loop and with memchr().  Every result is checked against the byte
+ * loop first.
+ *
+ * Usage: scan-bench [total_mb]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "line-scan.h"
+
+typedef const char *(*scan_fn)(const char *buf, size_t len);
+
+static const char *scan_bytes(const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') return buf + i;
+    }
+    return NULL;
+}
+
+static const char *scan_memchr(const char *buf, size_t len) {
+    return memchr(buf, '\n', len);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Split the buffer into packets with @p fn, return the packet count
+static size_t split(scan_fn fn, const char *buf, size_t len) {
+    size_t packets = 0;
+    while (len > 0) {
+        const char *nl = fn(buf, len);
+        if (!nl) break;
+        size_t n = nl - buf + 1;
+        buf += n;
+        len -= n;
+        packets++;
+    }
+    return packets;
+}
+
+static void fill(char *buf, size_t len, size_t pkt) {
+    for (size_t i = 0; i < len; i++) buf[i] = 'a' + i % 26;
+    for (size_t i = pkt - 1; i < len; i += pkt) buf[i] = '\n';
+}
+
+int main(int argc, char *argv[]) {
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 65536, 1 << 20 };
+    static const struct { const char *name; scan_fn fn; } impls[] = {
+        { "bytes", scan_bytes },
+        { "memchr", scan_memchr },
+        { "line_scan", line_scan },
+    };
+
+    char *buf = malloc(total);
+    if (!buf || total < 4096) return 1;
+
+    // Correctness first: every alignment, length and newline position across
+    // a few vector blocks, with a newline just past the end that must not count
+    for (size_t off = 0; off < 64; off++) {
+        for (size_t len = 0; len <= 200; len++) {
+            memset(buf, 'x', off + len);
+            buf[off + len] = '\n';
+            for (size_t nl = 0; nl <= len; nl++) {
+                if (nl < len) buf[off + nl] = '\n';
+                if (line_scan(buf + off, len) != scan_bytes(buf + off, len)) {
+                    fprintf(stderr, "mismatch: off %zu len %zu newline %zu\n", off, len, nl);
+                    return 1;
+                }
+                if (nl < len) buf[off + nl] = 'x';
+            }
+        }
+    }
+
+    printf("line_scan uses %s, %zu MB per run\n", line_scan_impl(), total >> 20);
+    printf("%10s", "packet");
+    for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) printf(" %12s", impls[j].name);
+    printf("   (MB/s)\n");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fill(buf, total, sizes[i]);
+        printf("%10zu", sizes[i]);
+        for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+            double t = now();
+            size_t packets = split(impls[j].fn, buf, total);
+            t = now() - t;
+            if (packets != total / sizes[i]) {
+                fprintf(stderr, "%s found %zu packets\n", impls[j].name, packets);
+                return 1;
+            }
+            printf(" %12.0f", (total >> 20) / t);
+        }
+        printf("\n");
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,429 @@
+/**
+ * @file seg-log.c
+ * @brief Segmented, size-bounded append log behind the regular file build
+ *
+ * Only the appender (serialised by the caller, in practice file_mutex) writes
+ * segment files and indexes.  seg_lock guards the segment list, lengths, the
+ * head and the pin counts, so replays can map offsets to files without
+ * file_mutex.  A segment that retention drops while a replay still has it
+ * pinned is unlinked at once and closed when the last pin goes.
+ *
+ * Rotation is two renames and trimming is an index lookup plus, once a whole
+ * segment is behind the head, two unlinks; neither touches the data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
+#include "aesdsocket.h"
+#include "seg-log.h"
+
+// A segment is sealed once the next record would take it past this size
+#define SEGMENT_SIZE (1024 * 1024)
+#define INDEX_INITIAL_CAPACITY 64
+
+struct segment {
+    unsigned id;
+    int fd;
+    int idx_fd;             // sidecar index, only open for the active segment
+    off_t base;             // log offset of the first byte
+    off_t len;              // bytes visible to readers
+    uint64_t first_rec;     // log record number of recs[0]
+    uint32_t *recs;         // byte offset of every record within the segment
+    size_t nrecs;
+    size_t cap;
+    unsigned pins;
+    bool retired;           // dropped by retention, freed when unpinned
+    TAILQ_ENTRY(segment) entries;
+};
+
+static TAILQ_HEAD(segment_list, segment) segments = TAILQ_HEAD_INITIALIZER(segments);
+static pthread_mutex_t seg_lock = PTHREAD_MUTEX_INITIALIZER;
+static char log_path[PATH_MAX - 32];   // room for the ".<id>.idx" suffixes
+static size_t retain_bytes;
+static size_t retain_records;
+static off_t head;          // oldest retained byte
+static uint64_t head_rec;   // oldest retained record
+static off_t end;
+static uint64_t end_rec;    // records ever appended, counted like offsets
+static struct iovec *run_iov;   // gather list for one writev, reused by every append
+static int run_iov_cap;
+
+// --- Segment files ---
+
+static void segment_names(const struct segment *seg, bool active, char *data, char *idx) {
+    if (active) {
+        snprintf(data, PATH_MAX, "%s", log_path);
+        snprintf(idx, PATH_MAX, "%s.idx", log_path);
+    } else {
+        snprintf(data, PATH_MAX, "%s.%08u", log_path, seg->id);
+        snprintf(idx, PATH_MAX, "%s.%08u.idx", log_path, seg->id);
+    }
+}
+
+static bool segment_is_active(const struct segment *seg) {
+    return seg == TAILQ_LAST(&segments, segment_list);
+}
+
+static void segment_free(struct segment *seg) {
+    if (seg->idx_fd >= 0) close(seg->idx_fd);
+    close(seg->fd);
+    free(seg->recs);
+    free(seg);
+}
+
+static int segment_add_record(struct segment *seg, uint32_t off) {
+    if (seg->nrecs == seg->cap) {
+        size_t cap = seg->cap ? seg->cap * 2 : INDEX_INITIAL_CAPACITY;
+        uint32_t *tmp = realloc(seg->recs, cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        seg->recs = tmp;
+        seg->cap = cap;
+    }
+    seg->recs[seg->nrecs++] = off;
+    return 0;
+}
+
+// Read the sidecar index, dropping entries past the data a crash left behind
+static int segment_load_index(struct segment *seg, int idx_fd) {
+    uint32_t off;
+    ssize_t n;
+
+    while ((n = read(idx_fd, &off, sizeof(off))) == sizeof(off)) {
+        if ((off_t)off >= seg->len || (seg->nrecs && off <= seg->recs[seg->nrecs - 1])) break;
+        if (segment_add_record(seg, off) < 0) return -1;
+    }
+    // Data without an index entry: treat it as a single record
+    if (seg->nrecs == 0 && seg->len > 0 && segment_add_record(seg, 0) < 0) return -1;
+    return 0;
+}
+
+static struct segment *segment_open(unsigned id, bool active) {
+    char data[PATH_MAX], idx[PATH_MAX];
+    struct stat st;
+    struct segment *seg = calloc(1, sizeof(*seg));
+    if (!seg) return NULL;
+
+    seg->id = id;
+    seg->idx_fd = -1;
+    segment_names(seg, active, data, idx);
+    seg->fd = open(data, (active ? O_RDWR | O_APPEND | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (seg->fd < 0) goto fail;
+    if (fstat(seg->fd, &st) < 0) goto fail_fd;
+    seg->len = st.st_size;
+
+    int idx_fd = open(idx, (active ? O_RDWR | O_APPEND | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (idx_fd >= 0) {
+        if (segment_load_index(seg, idx_fd) < 0) {
+            close(idx_fd);
+            goto fail_fd;
+        }
+        if (active) {
+            // Rewrite stale or missing entries so the file matches what was loaded
+            if (ftruncate(idx_fd, 0) < 0 ||
+                write(idx_fd, seg->recs, seg->nrecs * sizeof(*seg->recs)) < 0) {
+                close(idx_fd);
+                goto fail_fd;
+            }
+            seg->idx_fd = idx_fd;
+        } else {
+            close(idx_fd);
+        }
+    } else if (active || segment_load_index(seg, -1) < 0) {
+        goto fail_fd;
+    }
+    return seg;
+
+fail_fd:
+    close(seg->fd);
+fail:
+    free(seg->recs);
+    free(seg);
+    return NULL;
+}
+
+static void segment_link(struct segment *seg) {
+    struct segment *last = TAILQ_LAST(&segments, segment_list);
+    if (last) {
+        seg->base = last->base + last->len;
+        seg->first_rec = last->first_rec + last->nrecs;
+    }
+    TAILQ_INSERT_TAIL(&segments, seg, entries);
+}
+
+// Seal the active segment under its numbered name and start a new one
+static int segment_rotate(void) {
+    struct segment *active = TAILQ_LAST(&segments, segment_list);
+    char data[PATH_MAX], idx[PATH_MAX], sealed_data[PATH_MAX], sealed_idx[PATH_MAX];
+
+    segment_names(active, true, data, idx);
+    segment_names(active, false, sealed_data, sealed_idx);
+    if (rename(data, sealed_data) < 0) return -1;
+    if (rename(idx, sealed_idx) < 0) {
+        rename(sealed_data, data);
+        return -1;
+    }
+
+    struct segment *seg = segment_open(active->id + 1, true);
+    if (!seg) {
+        rename(sealed_idx, idx);
+        rename(sealed_data, data);
+        return -1;
+    }
+
+    pthread_mutex_lock(&seg_lock);
+    close(active->idx_fd);
+    active->idx_fd = -1;
+    segment_link(seg);
+    pthread_mutex_unlock(&seg_lock);
+    return 0;
+}
+
+// Drop the oldest segment once the head has moved past it.  Caller holds seg_lock.
+static void segment_retire(struct segment *seg) {
+    char data[PATH_MAX], idx[PATH_MAX];
+
+    segment_names(seg, false, data, idx);
+    unlink(data);
+    unlink(idx);
+    TAILQ_REMOVE(&segments, seg, entries);
+    if (seg->pins == 0) {
+        segment_free(seg);
+    } else {
+        seg->retired = true;
+    }
+}
+
+// Move the head forward record by record until the log is within its limits
+static void seglog_trim(void) {
+    while (head_rec + 1 < end_rec &&
+           ((retain_bytes && (size_t)(end - head) > retain_bytes) ||
+            (retain_records && end_rec - head_rec > retain_records))) {
+        struct segment *oldest = TAILQ_FIRST(&segments);
+        size_t i = head_rec - oldest->first_rec + 1;
+
+        head_rec++;
+        if (i < oldest->nrecs) {
+            head = oldest->base + oldest->recs[i];
+        } else {
+            head = oldest->base + oldest->len;
+            segment_retire(oldest);
+        }
+    }
+}
+
+static bool run_iov_reserve(int cnt) {
+    if (cnt <= run_iov_cap) return true;
+    int cap = run_iov_cap ? run_iov_cap : SEGLOG_MAX_BATCH;
+    while (cap < cnt) cap *= 2;
+    struct iovec *tmp = realloc(run_iov, cap * sizeof(*tmp));
+    if (!tmp) return false;
+    run_iov = tmp;
+    run_iov_cap = cap;
+    return true;
+}
+
+// --- Public API ---
+
+int seglog_open(const char *path, size_t bytes, size_t records) {
+    glob_t g;
+    char pattern[PATH_MAX];
+    unsigned next_id = 1;
+
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    retain_bytes = bytes;
+    retain_records = records;
+
+    // Sealed segments are DATA_FILE.<8 digit id>, glob returns them oldest first
+    snprintf(pattern, sizeof(pattern), "%s.[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]", path);
+    if (glob(pattern, 0, NULL, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            unsigned id = (unsigned)strtoul(g.gl_pathv[i] + strlen(path) + 1, NULL, 10);
+            struct segment *seg = segment_open(id, false);
+            if (!seg) {
+                syslog(LOG_WARNING, "Skipping unreadable log segment %s", g.gl_pathv[i]);
+                continue;
+            }
+            if (seg->len == 0) {
+                // Retention assumes every sealed segment holds a record
+                pthread_mutex_lock(&seg_lock);
+                TAILQ_INSERT_TAIL(&segments, seg, entries);
+                segment_retire(seg);
+                pthread_mutex_unlock(&seg_lock);
+                continue;
+            }
+            segment_link(seg);
+            next_id = id + 1;
+        }
+        globfree(&g);
+    }
+
+    struct segment *active = segment_open(next_id, true);
+    if (!active) {
+        seglog_close();
+        return -1;
+    }
+    segment_link(active);
+
+    head = TAILQ_FIRST(&segments)->base;
+    head_rec = TAILQ_FIRST(&segments)->first_rec;
+    end = active->base + active->len;
+    end_rec = active->first_rec + active->nrecs;
+    return 0;
+}
+
+void seglog_close(void) {
+    pthread_mutex_lock(&seg_lock);
+    while (!TAILQ_EMPTY(&segments)) {
+        struct segment *seg = TAILQ_FIRST(&segments);
+        char data[PATH_MAX], idx[PATH_MAX];
+
+        segment_names(seg, segment_is_active(seg), data, idx);
+        unlink(data);
+        unlink(idx);
+        TAILQ_REMOVE(&segments, seg, entries);
+        segment_free(seg);
+    }
+    head = end = 0;
+    head_rec = end_rec = 0;
+    pthread_mutex_unlock(&seg_lock);
+
+    free(run_iov);
+    run_iov = NULL;
+    run_iov_cap = 0;
+}
+
+int seglog_append(const struct seglog_rec *recs, int cnt, bool sync) {
+    uint32_t offs[SEGLOG_MAX_BATCH];
+    int i = 0;
+
+    while (i < cnt) {
+        struct segment *active = TAILQ_LAST(&segments, segment_list);
+
+        if (active->len > 0 && active->len + (off_t)recs[i].len > SEGMENT_SIZE) {
+            if (segment_rotate() < 0) {
+                syslog(LOG_WARNING, "Could not rotate %s: %s", log_path, strerror(errno));
+            } else {
+                active = TAILQ_LAST(&segments, segment_list);
+            }
+        }
+
+        // Every record that still fits the segment goes out in one writev
+        off_t run_len = 0;
+        int n = 0;
+        int niov = 0;
+        do {
+            const struct seglog_rec *r = &recs[i + n];
+            if (!run_iov_reserve(niov + r->iovcnt)) break;
+            offs[n] = (uint32_t)(active->len + run_len);
+            if (segment_add_record(active, offs[n]) < 0) break;
+            memcpy(run_iov + niov, r->iov, r->iovcnt * sizeof(*r->iov));
+            niov += r->iovcnt;
+            run_len += r->len;
+            n++;
+        } while (i + n < cnt && active->len + run_len + (off_t)recs[i + n].len <= SEGMENT_SIZE);
+        if (n == 0) return -1;
+
+        off_t written = run_len;
+        bool failed = writev_all(active->fd, run_iov, niov) < 0;
+        if (failed) {
+            // Keep the records that made it, at least partly, as a single append did
+            struct stat st;
+            written = (fstat(active->fd, &st) == 0) ? st.st_size - active->len : 0;
+            while (n > 0 && offs[n - 1] >= active->len + written) {
+                active->nrecs--;
+                n--;
+            }
+        }
+        // The index is only a hint for recovery, a failed write is caught by the bounds check
+        if (n > 0 && write(active->idx_fd, offs, n * sizeof(*offs)) < 0) {
+            syslog(LOG_WARNING, "Could not update %s.idx: %s", log_path, strerror(errno));
+        }
+        if (sync && n > 0 && fdatasync(active->fd) < 0) {
+            syslog(LOG_WARNING, "Could not sync %s: %s", log_path, strerror(errno));
+        }
+
+        pthread_mutex_lock(&seg_lock);
+        active->len += written;
+        end += written;
+        end_rec += n;
+        seglog_trim();
+        pthread_mutex_unlock(&seg_lock);
+
+        if (failed) return -1;
+        i += n;
+    }
+    return 0;
+}
+
+off_t seglog_head(void) {
+    pthread_mutex_lock(&seg_lock);
+    off_t off = head;
+    pthread_mutex_unlock(&seg_lock);
+    return off;
+}
+
+off_t seglog_end(void) {
+    pthread_mutex_lock(&seg_lock);
+    off_t off = end;
+    pthread_mutex_unlock(&seg_lock);
+    return off;
+}
+
+off_t seglog_record_offset(uint32_t rec, uint32_t rec_off) {
+    uint64_t target = head_rec + rec;
+    struct segment *seg;
+
+    if (target >= end_rec) return -1;
+    TAILQ_FOREACH(seg, &segments, entries) {
+        if (target >= seg->first_rec + seg->nrecs) continue;
+
+        size_t i = target - seg->first_rec;
+        off_t start = seg->recs[i];
+        off_t stop = (i + 1 < seg->nrecs) ? seg->recs[i + 1] : seg->len;
+        if ((off_t)rec_off >= stop - start) return -1;
+        return seg->base + start + rec_off;
+    }
+    return -1;
+}
+
+void seglog_span_get(off_t *off, struct seglog_span *span) {
+    struct segment *seg;
+
+    memset(span, 0, sizeof(*span));
+    span->fd = -1;
+
+    pthread_mutex_lock(&seg_lock);
+    if (*off < head) *off = head;
+    TAILQ_FOREACH(seg, &segments, entries) {
+        if (*off < seg->base + seg->len) {
+            seg->pins++;
+            span->seg = seg;
+            span->fd = seg->fd;
+            span->file_off = *off - seg->base;
+            span->len = seg->len - span->file_off;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&seg_lock);
+}
+
+void seglog_span_put(struct seglog_span *span) {
+    struct segment *seg = span->seg;
+    if (!seg) return;
+
+    pthread_mutex_lock(&seg_lock);
+    if (--seg->pins == 0 && seg->retired) segment_free(seg);
+    pthread_mutex_unlock(&seg_lock);
+    span->seg = NULL;
+}
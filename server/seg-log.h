@@ -0,0 +1,80 @@
+/**
+ * @file seg-log.h
+ * @brief Segmented, size-bounded append log behind the regular file build
+ *
+ * Records (one per append) are written to DATA_FILE, the active segment.  When
+ * it fills up it is renamed to DATA_FILE.<id> and a new one is started.  Each
+ * segment has a sidecar index, DATA_FILE[.<id>].idx, holding the byte offset
+ * of every record in it.  A retention limit in bytes or records moves the log
+ * head forward one record at a time and unlinks segments it leaves behind.
+ *
+ * Log offsets count from the first byte the log holds at startup and only
+ * grow; the head is the oldest byte still retained.
+ */
+
+#ifndef SEG_LOG_H
+#define SEG_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Contiguous run of log bytes inside one segment file
+struct seglog_span {
+    int fd;
+    off_t file_off;
+    size_t len;             // 0 once the offset reaches the end of the log
+    struct segment *seg;    // pinned until seglog_span_put()
+};
+
+/**
+ * Open the log at @p path, recovering segments and indexes left by an earlier
+ * run.  A limit of 0 means unbounded.
+ * @return 0 on success, -1 with errno set
+ */
+int seglog_open(const char *path, size_t retain_bytes, size_t retain_records);
+
+/**
+ * Close the log and delete every segment and index file.
+ */
+void seglog_close(void);
+
+// Most records one seglog_append() call takes
+#define SEGLOG_MAX_BATCH 64
+
+// One record, gathered from @p iovcnt pieces totalling @p len bytes
+struct seglog_rec {
+    const struct iovec *iov;
+    int iovcnt;
+    size_t len;
+};
+
+/**
+ * Append @p cnt records (at most SEGLOG_MAX_BATCH), rotating and trimming as
+ * needed.  Records that share a segment go out in one writev; with @p sync
+ * each touched segment is fdatasync()ed before returning.  Caller serialises
+ * appends.
+ * @return 0 on success, -1 if a write failed
+ */
+int seglog_append(const struct seglog_rec *recs, int cnt, bool sync);
+
+off_t seglog_head(void);
+off_t seglog_end(void);
+
+/**
+ * Map byte @p rec_off of record @p rec (counted from the head) to a log
+ * offset using the index.  Caller serialises this with appends.
+ * @return the log offset, or -1 if the record or byte is not in the log
+ */
+off_t seglog_record_offset(uint32_t rec, uint32_t rec_off);
+
+/**
+ * Find the bytes at log offset *@p off and pin their segment.  Retention may
+ * have dropped them already; *@p off then moves up to the head.
+ */
+void seglog_span_get(off_t *off, struct seglog_span *span);
+void seglog_span_put(struct seglog_span *span);
+
+#endif /* SEG_LOG_H */
@@ -0,0 +1,297 @@
+/**
+ * @file stats.c
+ * @brief Counters and latency histograms for the packet path
+ *
+ * A thread gets its shard the first time it records anything.  Shards are
+ * linked on a registry; when a thread exits its shard is folded into the
+ * retired totals and freed, so per-client threads do not leak shards.  The
+ * owner is the only writer of a shard and a report reads it concurrently,
+ * hence the relaxed atomics on both sides: values may be a few records
+ * apart from each other, but never torn.
+ */
+
+#define _GNU_SOURCE     // accept4, open_memstream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "aesdsocket.h"
+#include "stats.h"
+#include "hist.h"
+
+// How long a stats client may take to say which format it wants
+#define STATS_REQ_TIMEOUT_MS 200
+
+struct stats_shard {
+    struct stats_shard *next;
+    uint64_t counters[STAT_COUNTER_COUNT];
+    struct hist hist[STAT_HIST_COUNT];
+};
+
+static const char *const counter_names[STAT_COUNTER_COUNT] = {
+    [STAT_ACCEPTS] = "connections_accepted",
+    [STAT_BYTES_IN] = "bytes_in",
+    [STAT_BYTES_OUT] = "bytes_out",
+    [STAT_PACKETS] = "packets",
+    [STAT_SEEKS] = "seeks",
+    [STAT_STORE_ERRORS] = "store_errors",
+    [STAT_DROPPED] = "clients_dropped",
+    [STAT_FRAMES] = "binary_frames",
+    [STAT_COALESCED] = "replays_coalesced",
+};
+
+static const char *const hist_names[STAT_HIST_COUNT] = {
+    [HIST_RECV] = "recv",
+    [HIST_LOCK_WAIT] = "lock_wait",
+    [HIST_LOCK_HOLD] = "lock_hold",
+    [HIST_STORE_WRITE] = "store_write",
+    [HIST_SEEK] = "seek",
+    [HIST_COMMIT] = "commit",
+    [HIST_REPLAY] = "replay",
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_shard *shards;      // live threads
+static struct stats_shard retired;      // totals of exited threads, under registry_lock
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread struct stats_shard *my_shard;
+
+static uint64_t start_ns;
+static long conns_active;
+
+static int stats_fd = -1;
+static pthread_t stats_thread;
+static struct sockaddr_un stats_addr;
+
+// --- Shards ---
+
+static void shard_merge(struct stats_shard *dst, struct stats_shard *src) {
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        dst->counters[i] += __atomic_load_n(&src->counters[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < STAT_HIST_COUNT; i++) hist_merge(&dst->hist[i], &src->hist[i]);
+}
+
+static void shard_retire(void *arg) {
+    struct stats_shard *shard = arg;
+
+    pthread_mutex_lock(&registry_lock);
+    for (struct stats_shard **p = &shards; *p; p = &(*p)->next) {
+        if (*p == shard) {
+            *p = shard->next;
+            break;
+        }
+    }
+    shard_merge(&retired, shard);
+    pthread_mutex_unlock(&registry_lock);
+    free(shard);
+}
+
+static void key_create(void) {
+    pthread_key_create(&shard_key, shard_retire);
+}
+
+static struct stats_shard *shard_get(void) {
+    if (my_shard) return my_shard;
+
+    pthread_once(&key_once, key_create);
+    struct stats_shard *shard = calloc(1, sizeof(*shard));
+    if (!shard) return NULL;
+    pthread_setspecific(shard_key, shard);
+
+    pthread_mutex_lock(&registry_lock);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&registry_lock);
+    return my_shard = shard;
+}
+
+// --- Recording ---
+
+void stats_count(enum stat_counter c, uint64_t n) {
+    struct stats_shard *shard = shard_get();
+    if (shard) __atomic_fetch_add(&shard->counters[c], n, __ATOMIC_RELAXED);
+}
+
+void stats_record(enum stat_hist h, uint64_t ns) {
+    struct stats_shard *shard = shard_get();
+    if (shard) hist_record(&shard->hist[h], ns);
+}
+
+void stats_conn_open(void) {
+    stats_count(STAT_ACCEPTS, 1);
+    __atomic_fetch_add(&conns_active, 1, __ATOMIC_RELAXED);
+}
+
+void stats_conn_close(void) {
+    __atomic_fetch_sub(&conns_active, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_mutex_lock(pthread_mutex_t *m) {
+    uint64_t t = stats_now();
+    pthread_mutex_lock(m);
+    uint64_t locked = stats_now();
+    stats_record(HIST_LOCK_WAIT, locked - t);
+    return locked;
+}
+
+void stats_mutex_unlock(pthread_mutex_t *m, uint64_t locked) {
+    uint64_t held = stats_now() - locked;
+    pthread_mutex_unlock(m);
+    stats_record(HIST_LOCK_HOLD, held);
+}
+
+// --- Reports ---
+
+static void report_hist(FILE *f, bool json, const char *name, const struct hist *d, bool first) {
+    static const struct { const char *name; double p; } pcts[] = {
+        { "p50", 0.50 }, { "p90", 0.90 }, { "p99", 0.99 }, { "p999", 0.999 },
+    };
+    uint64_t mean = d->count ? d->sum / d->count : 0;
+
+    if (json) {
+        fprintf(f, "%s\"%s\":{\"count\":%llu,\"mean\":%llu", first ? "" : ",", name,
+                (unsigned long long)d->count, (unsigned long long)mean);
+    } else {
+        fprintf(f, "%s_ns count=%llu mean=%llu", name,
+                (unsigned long long)d->count, (unsigned long long)mean);
+    }
+    for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+        unsigned long long v = hist_percentile(d, pcts[i].p);
+        fprintf(f, json ? ",\"%s\":%llu" : " %s=%llu", pcts[i].name, v);
+    }
+    fprintf(f, json ? ",\"max\":%llu}" : " max=%llu\n", (unsigned long long)d->max);
+}
+
+char *stats_report(bool json, size_t *len) {
+    struct stats_shard *total = calloc(1, sizeof(*total));
+    if (!total) return NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    shard_merge(total, &retired);
+    for (struct stats_shard *s = shards; s; s = s->next) shard_merge(total, s);
+    pthread_mutex_unlock(&registry_lock);
+
+    double uptime = (stats_now() - start_ns) / 1e9;
+    long active = __atomic_load_n(&conns_active, __ATOMIC_RELAXED);
+    double accept_rate = uptime > 0 ? total->counters[STAT_ACCEPTS] / uptime : 0;
+
+    char *buf = NULL;
+    FILE *f = open_memstream(&buf, len);
+    if (!f) {
+        free(total);
+        return NULL;
+    }
+
+    if (json) {
+        fprintf(f, "{\"uptime_seconds\":%.3f,\"connections_active\":%ld,\"accept_rate\":%.3f,\"counters\":{",
+                uptime, active, accept_rate);
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+            fprintf(f, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+                    (unsigned long long)total->counters[i]);
+        }
+        fprintf(f, "},\"latency_ns\":{");
+    } else {
+        fprintf(f, "uptime_seconds %.3f\nconnections_active %ld\naccept_rate %.3f\n",
+                uptime, active, accept_rate);
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+            fprintf(f, "%s %llu\n", counter_names[i], (unsigned long long)total->counters[i]);
+        }
+    }
+    for (int i = 0; i < STAT_HIST_COUNT; i++) {
+        report_hist(f, json, hist_names[i], &total->hist[i], i == 0);
+    }
+    if (json) fprintf(f, "}}\n");
+
+    free(total);
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// --- Stats socket ---
+
+static void stats_reply(int fd) {
+    char req[16] = "";
+
+    // The request is optional, a client that just connects gets text
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, STATS_REQ_TIMEOUT_MS) > 0) {
+        ssize_t n = recv(fd, req, sizeof(req) - 1, 0);
+        if (n > 0) req[n] = '\0';
+    }
+
+    size_t len;
+    char *report = stats_report(strncmp(req, "json", 4) == 0, &len);
+    if (report) {
+        send_all(fd, report, len);
+        free(report);
+    }
+}
+
+static void *stats_loop(void *arg) {
+    (void)arg;
+    for (;;) {
+        int fd = accept4(stats_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;  // stats_stop() shut the socket down
+        }
+        stats_reply(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+void stats_init(void) {
+    start_ns = stats_now();
+}
+
+int stats_serve(const char *path) {
+    if (strlen(path) >= sizeof(stats_addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    stats_addr.sun_family = AF_UNIX;
+    strcpy(stats_addr.sun_path, path);
+
+    stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (stats_fd < 0) return -1;
+
+    // A stale socket from a crashed run would make bind() fail
+    unlink(path);
+    if (bind(stats_fd, (struct sockaddr *)&stats_addr, sizeof(stats_addr)) < 0 ||
+        listen(stats_fd, 8) < 0) {
+        goto fail;
+    }
+    int err = pthread_create(&stats_thread, NULL, stats_loop, NULL);
+    if (err != 0) {
+        unlink(path);
+        errno = err;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(stats_fd);
+    stats_fd = -1;
+    return -1;
+}
+
+void stats_stop(void) {
+    if (stats_fd < 0) return;
+    shutdown(stats_fd, SHUT_RDWR);
+    pthread_join(stats_thread, NULL);
+    close(stats_fd);
+    stats_fd = -1;
+    unlink(stats_addr.sun_path);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file stats.h
+ * @brief Counters and latency histograms for the packet path
+ *
+ * Every thread records into its own shard, so the hot path only does relaxed
+ * adds on cache lines no other thread writes.  A report merges all shards on
+ * demand.  Latencies go into log-linear histograms (hist.c).
+ *
+ * Reports are served in text or JSON over a Unix socket enabled with -s:
+ *
+ *   $ echo json | socat - UNIX-CONNECT:/var/tmp/aesdsocket.stats
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+enum stat_counter {
+    STAT_ACCEPTS,           // connections accepted
+    STAT_BYTES_IN,          // bytes received from clients
+    STAT_BYTES_OUT,         // replay bytes sent to clients
+    STAT_PACKETS,           // packets appended to the store
+    STAT_SEEKS,             // AESDCHAR_IOCSEEKTO commands
+    STAT_STORE_ERRORS,      // appends that failed
+    STAT_DROPPED,           // clients disconnected for falling behind
+    STAT_FRAMES,            // binary protocol requests
+    STAT_COALESCED,         // replays dropped for a later one that covers them
+    STAT_COUNTER_COUNT,
+};
+
+enum stat_hist {
+    HIST_RECV,              // one recv() call
+    HIST_LOCK_WAIT,         // waiting for file_mutex
+    HIST_LOCK_HOLD,         // file_mutex held
+    HIST_STORE_WRITE,       // one batch written to DATA_FILE
+    HIST_SEEK,              // resolving a seek command (the ioctl for the char device)
+    HIST_COMMIT,            // commit_packet(), group commit wait included
+    HIST_REPLAY,            // replay queued until its last byte went to the socket
+    STAT_HIST_COUNT,
+};
+
+/**
+ * Start the uptime clock.  Called once at startup.
+ */
+void stats_init(void);
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void stats_count(enum stat_counter c, uint64_t n);
+
+/**
+ * Record a latency of @p ns nanoseconds.
+ */
+void stats_record(enum stat_hist h, uint64_t ns);
+
+/**
+ * Record the time since @p start, a stats_now() value.
+ */
+static inline void stats_since(enum stat_hist h, uint64_t start) {
+    stats_record(h, stats_now() - start);
+}
+
+// Connection gauge, open and close may happen on different threads
+void stats_conn_open(void);
+void stats_conn_close(void);
+
+/**
+ * Lock @p m, recording the wait.
+ * @return the time the lock was taken, for stats_mutex_unlock()
+ */
+uint64_t stats_mutex_lock(pthread_mutex_t *m);
+
+/**
+ * Unlock @p m, recording how long it was held since @p locked.
+ */
+void stats_mutex_unlock(pthread_mutex_t *m, uint64_t locked);
+
+/**
+ * Merge every shard into a report.
+ * @return a malloc'd report of @p len bytes, NULL if out of memory
+ */
+char *stats_report(bool json, size_t *len);
+
+/**
+ * Serve reports on a Unix stream socket at @p path from a background thread.
+ * A client may send "json" or "text" (the default) and gets one report.
+ * @return 0 on success, -1 with errno set
+ */
+int stats_serve(const char *path);
+
+/**
+ * Stop the stats socket, if any, and remove it.
+ */
+void stats_stop(void);
+
+#endif /* STATS_H */
@@ -0,0 +1,227 @@
+/**
+ * @file thread-pool.c
+ * @brief Fixed size worker pool with per-worker deques and work stealing
+ *
+ * Each worker owns a deque.  The owner pushes and pops at the bottom (newest
+ * job first, which keeps its caches warm) while idle workers steal from the
+ * top (oldest job first).  Jobs submitted from outside the pool are spread
+ * round-robin; jobs submitted from a worker land on its own deque.
+ *
+ * A pool wide pending count lets idle workers sleep on a condition variable
+ * instead of spinning over empty deques.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "thread-pool.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+struct pool_job {
+    pool_job_fn fn;
+    void *arg;
+};
+
+struct work_deque {
+    pthread_mutex_t lock;
+    struct pool_job *jobs;  // ring buffer, capacity is a power of two
+    size_t cap;
+    size_t top;             // steal end, oldest job
+    size_t bottom;          // owner end, jobs live in [top, bottom)
+};
+
+struct worker {
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+    struct work_deque dq;
+};
+
+struct thread_pool {
+    int nworkers;
+    struct worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    size_t pending;         // jobs queued but not yet taken (atomic)
+    bool stopping;          // guarded by lock
+    unsigned next;          // round-robin cursor for external submits (atomic)
+};
+
+static __thread struct worker *current_worker;
+
+// --- Deque ---
+
+static int deque_init(struct work_deque *dq) {
+    dq->jobs = malloc(DEQUE_INITIAL_CAPACITY * sizeof(*dq->jobs));
+    if (!dq->jobs) return -1;
+    dq->cap = DEQUE_INITIAL_CAPACITY;
+    dq->top = dq->bottom = 0;
+    pthread_mutex_init(&dq->lock, NULL);
+    return 0;
+}
+
+static void deque_destroy(struct work_deque *dq) {
+    pthread_mutex_destroy(&dq->lock);
+    free(dq->jobs);
+}
+
+static int deque_push(struct work_deque *dq, struct pool_job job) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom - dq->top == dq->cap) {
+        struct pool_job *grown = malloc(2 * dq->cap * sizeof(*grown));
+        if (!grown) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = dq->top; i != dq->bottom; i++) {
+            grown[i & (2 * dq->cap - 1)] = dq->jobs[i & (dq->cap - 1)];
+        }
+        free(dq->jobs);
+        dq->jobs = grown;
+        dq->cap *= 2;
+    }
+    dq->jobs[dq->bottom & (dq->cap - 1)] = job;
+    dq->bottom++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static bool deque_pop_bottom(struct work_deque *dq, struct pool_job *job) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        dq->bottom--;
+        *job = dq->jobs[dq->bottom & (dq->cap - 1)];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static bool deque_steal_top(struct work_deque *dq, struct pool_job *job) {
+    bool found = false;
+    // Never wait on a busy victim, just move on to the next one
+    if (pthread_mutex_trylock(&dq->lock) != 0) return false;
+    if (dq->bottom != dq->top) {
+        *job = dq->jobs[dq->top & (dq->cap - 1)];
+        dq->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// --- Workers ---
+
+static bool worker_find_job(struct worker *w, struct pool_job *job) {
+    struct thread_pool *pool = w->pool;
+
+    if (deque_pop_bottom(&w->dq, job)) return true;
+
+    for (int i = 1; i < pool->nworkers; i++) {
+        struct worker *victim = &pool->workers[(w->index + i) % pool->nworkers];
+        if (deque_steal_top(&victim->dq, job)) return true;
+    }
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct thread_pool *pool = w->pool;
+    struct pool_job job;
+
+    current_worker = w;
+
+    for (;;) {
+        if (worker_find_job(w, &job)) {
+            __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+            job.fn(job.arg);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        bool done = pool->stopping && __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+// --- Pool ---
+
+int thread_pool_default_size(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu > 0) ? (int)ncpu : 1;
+}
+
+struct thread_pool *thread_pool_create(int nworkers) {
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+
+    pool->workers = calloc(nworkers, sizeof(*pool->workers));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (int i = 0; i < nworkers; i++) {
+        struct worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        if (deque_init(&w->dq) < 0) break;
+        // Publish the worker before it can be picked as a steal victim
+        pool->nworkers = i + 1;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            deque_destroy(&w->dq);
+            pool->nworkers = i;
+            break;
+        }
+    }
+
+    if (pool->nworkers == 0) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int thread_pool_submit(struct thread_pool *pool, pool_job_fn fn, void *arg) {
+    struct pool_job job = { .fn = fn, .arg = arg };
+    struct worker *target = current_worker;
+
+    if (target == NULL || target->pool != pool) {
+        unsigned n = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        target = &pool->workers[n % pool->nworkers];
+    }
+    if (deque_push(&target->dq, job) < 0) return -1;
+
+    __atomic_fetch_add(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void thread_pool_destroy(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nworkers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        deque_destroy(&pool->workers[i].dq);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,36 @@
+/**
+ * @file thread-pool.h
+ * @brief Fixed size worker pool with per-worker deques and work stealing
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+typedef void (*pool_job_fn)(void *arg);
+
+struct thread_pool;
+
+/**
+ * @return the number of online CPUs, the default pool size
+ */
+int thread_pool_default_size(void);
+
+/**
+ * Start @p nworkers worker threads.
+ * @return the pool, or NULL if it could not be created
+ */
+struct thread_pool *thread_pool_create(int nworkers);
+
+/**
+ * Queue @p fn(@p arg) on one of the worker deques.  Idle workers steal from
+ * busy ones, so the choice of deque only affects locality.
+ * @return 0 on success, -1 if the job could not be queued
+ */
+int thread_pool_submit(struct thread_pool *pool, pool_job_fn fn, void *arg);
+
+/**
+ * Run every queued job to completion, then stop and join the workers.
+ */
+void thread_pool_destroy(struct thread_pool *pool);
+
+#endif /* THREAD_POOL_H */
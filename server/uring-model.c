@@ -0,0 +1,681 @@
+/**
+ * @file uring-model.c
+ * @brief io_uring connection model for aesdsocket
+ *
+ * A single thread drives every client through one io_uring instance, talking
+ * to the kernel with the raw syscalls so no liburing is needed on target.
+ * Each client gets a registered replay buffer while slots last.  Packets are
+ * committed through commit_packet() like in every other model, which keeps the log index and the mirror current; the replay then
+ * reads the store at explicit offsets up to the end snapshot of the commit.
+ *
+ * Every client advances in steps.  A step is a chain of linked SQEs and the
+ * state machine only looks at the results once all of its CQEs are in:
+ *
+ *   STEP_RECV   - RECV into the tail chunk of the receive buffer
+ *   STEP_REPLAY - READ_FIXED (next chunk) -> SEND
+ *   STEP_SEND   - SEND the unsent tail of a chunk
+ *   STEP_MSG    - SEND the in-memory part of a binary reply (proto.h)
+ *
+ * A short read cuts the chain, so the SEND of a partial chunk comes back
+ * -ECANCELED and is reissued with the real length as a STEP_SEND.  Full
+ * chunks go out in the same io_uring_enter() as the read that filled them.
+ *
+ * The kernel must support RECV/SEND/ACCEPT and READ (5.6+); otherwise uring_model_run() fails with ENOSYS and the
+ * caller falls back to the thread model.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include "aesdsocket.h"
+#include "data-store.h"
+#include "rx-buf.h"
+#include "proto.h"
+#include "stats.h"
+
+#if __has_include(<linux/io_uring.h>)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256
+#define REPLAY_CHUNK (16 * 1024)
+#define REPLAY_SLOTS 256            // registered replay buffers, REPLAY_CHUNK each
+
+// Low bits of user_data carry the operation, the rest is the conn pointer
+enum uring_op {
+    OP_ACCEPT = 0,
+    OP_RECV,
+    OP_READ,
+    OP_SEND,
+    OP_COUNT,
+};
+#define OP_MASK 7ULL
+
+enum conn_step {
+    STEP_RECV,
+    STEP_REPLAY,
+    STEP_SEND,
+    STEP_MSG,
+};
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned to_submit;             // SQEs queued since the last enter
+    unsigned inflight;              // SQEs submitted whose CQE has not been reaped
+};
+
+struct conn {
+    int fd;
+    enum conn_step step;
+    unsigned inflight;              // CQEs still expected for the current step
+    int res[OP_COUNT];              // results of the current step
+    bool closing;
+    struct rx_buf rx;               // received bytes not yet committed
+    size_t frame_len;               // length of the packet being committed
+    off_t replay_off;               // next store offset to replay
+    off_t replay_end;               // store_end() snapshot taken at commit
+    uint64_t replay_start;          // stats_now() once committed
+    char *msg;                      // binary reply header sent ahead of the replay
+    size_t msg_len;
+    size_t msg_sent;
+    bool framed;                    // the replay must go out whole
+    struct proto_reply pending;     // next reply, served ahead while coalescing
+    bool has_pending;
+    struct store_span span;         // pinned while a READ is in flight
+    char *chunk;                    // replay buffer, registered when slot >= 0
+    int slot;
+    size_t chunk_len;
+    size_t chunk_sent;
+    LIST_ENTRY(conn) entries;
+};
+
+struct uring_server {
+    struct uring ring;
+    int listen_fd;
+    char *slots;                    // REPLAY_SLOTS * REPLAY_CHUNK registered bytes
+    bool slot_used[REPLAY_SLOTS];
+    bool accepting;
+    LIST_HEAD(conn_list, conn) conns;
+};
+
+// --- Ring plumbing ---
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_unmap(struct uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_size);
+}
+
+static int uring_init(struct uring *ring, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) return -1;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) goto fail;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    uring_unmap(ring);
+    close(ring->fd);
+    return -1;
+}
+
+static void uring_exit(struct uring *ring) {
+    uring_unmap(ring);
+    close(ring->fd);
+}
+
+// All ops this model submits must be supported, otherwise fall back
+static bool uring_probe(struct uring *ring) {
+    static const uint8_t needed[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+        IORING_OP_READ, IORING_OP_READ_FIXED,
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    bool ok = probe && sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (size_t i = 0; ok && i < sizeof(needed); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static int uring_enter(struct uring *ring, unsigned min_complete) {
+    int ret = sys_io_uring_enter(ring->fd, ring->to_submit, min_complete,
+                                 min_complete ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0) return -1;
+    ring->to_submit -= (unsigned)ret;
+    return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    unsigned tail = *ring->sq_tail;
+
+    // Submission queue full: hand what we have to the kernel first
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_enter(ring, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return NULL;
+        }
+    }
+
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    ring->inflight++;
+    return sqe;
+}
+
+// --- Connection steps ---
+
+static void conn_queue(struct uring_server *srv, struct conn *c, uint8_t opcode, enum uring_op op,
+                       int fd, const void *addr, unsigned len, uint64_t off, uint8_t flags) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&srv->ring);
+    if (!sqe) return;
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->flags = flags;
+    sqe->user_data = (uintptr_t)c | op;
+    c->res[op] = 0;
+    c->inflight++;
+}
+
+static void conn_step_recv(struct uring_server *srv, struct conn *c) {
+    size_t room;
+    char *space = rx_buf_space(&c->rx, &room);
+    if (!space) {
+        c->closing = true;
+        return;
+    }
+    c->step = STEP_RECV;
+    conn_queue(srv, c, IORING_OP_RECV, OP_RECV, c->fd, space, room, 0, 0);
+}
+
+static void conn_step_commit(struct uring_server *srv, struct conn *c);
+static void conn_start_reply(struct uring_server *srv, struct conn *c, const struct proto_reply *reply);
+
+// Serve packets left over from an earlier RECV before asking for more
+static void conn_step_next(struct uring_server *srv, struct conn *c) {
+    ssize_t len = proto_frame(&c->rx);
+    if (len < 0) {
+        c->closing = true;
+    } else if (len > 0) {
+        c->frame_len = len;
+        conn_step_commit(srv, c);
+    } else {
+        conn_step_recv(srv, c);
+    }
+}
+
+/**
+ * Queue READ -> SEND for the next replay chunk from the segment pinned in
+ * c->span.
+ * @return false when there is nothing left to replay
+ */
+static bool conn_queue_chunk(struct uring_server *srv, struct conn *c) {
+    off_t from = c->replay_off;
+    store_span_get(&c->replay_off, &c->span);
+    if (c->framed && c->replay_off != from) {
+        // Retention dropped part of a frame payload, the client would lose sync
+        store_span_put(&c->span);
+        c->closing = true;
+        return true;
+    }
+
+    off_t left = c->replay_end - c->replay_off;
+    size_t want = c->span.len < REPLAY_CHUNK ? c->span.len : REPLAY_CHUNK;
+    if (left <= 0) want = 0;
+    else if ((off_t)want > left) want = left;
+    if (want == 0) {
+        store_span_put(&c->span);
+        return false;
+    }
+
+    if (c->slot >= 0) {
+        struct io_uring_sqe *sqe;
+        conn_queue(srv, c, IORING_OP_READ_FIXED, OP_READ, c->span.fd,
+                   c->chunk, want, c->span.file_off, IOSQE_IO_LINK);
+        sqe = &srv->ring.sqes[(*srv->ring.sq_tail - 1) & *srv->ring.sq_mask];
+        sqe->buf_index = c->slot;
+    } else {
+        conn_queue(srv, c, IORING_OP_READ, OP_READ, c->span.fd,
+                   c->chunk, want, c->span.file_off, IOSQE_IO_LINK);
+    }
+    // Only runs if the read filled the whole chunk; MSG_WAITALL asks for all of it in one go
+    conn_queue(srv, c, IORING_OP_SEND, OP_SEND, c->fd, c->chunk, want, 0, 0);
+    srv->ring.sqes[(*srv->ring.sq_tail - 1) & *srv->ring.sq_mask].msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    return true;
+}
+
+static void conn_replay_done(struct uring_server *srv, struct conn *c) {
+    if (c->framed && c->replay_off < c->replay_end) {
+        c->closing = true;
+        return;
+    }
+    stats_since(HIST_REPLAY, c->replay_start);
+    free(c->msg);
+    c->msg = NULL;
+    if (c->has_pending) {
+        c->has_pending = false;
+        conn_start_reply(srv, c, &c->pending);
+        return;
+    }
+    conn_step_next(srv, c);
+}
+
+static void conn_step_replay(struct uring_server *srv, struct conn *c) {
+    c->step = STEP_REPLAY;
+    if (!conn_queue_chunk(srv, c)) conn_replay_done(srv, c);
+}
+
+static void conn_step_msg(struct uring_server *srv, struct conn *c) {
+    c->step = STEP_MSG;
+    conn_queue(srv, c, IORING_OP_SEND, OP_SEND, c->fd, c->msg + c->msg_sent,
+               c->msg_len - c->msg_sent, 0, 0);
+    srv->ring.sqes[(*srv->ring.sq_tail - 1) & *srv->ring.sq_mask].msg_flags =
+        MSG_NOSIGNAL | (c->replay_off < c->replay_end ? MSG_MORE : 0);
+}
+
+static void conn_step_send(struct uring_server *srv, struct conn *c) {
+    c->step = STEP_SEND;
+    conn_queue(srv, c, IORING_OP_SEND, OP_SEND, c->fd, c->chunk + c->chunk_sent,
+               c->chunk_len - c->chunk_sent, 0, 0);
+    srv->ring.sqes[(*srv->ring.sq_tail - 1) & *srv->ring.sq_mask].msg_flags = MSG_NOSIGNAL;
+}
+
+// Send @p reply: its message if it has one, then its store range
+static void conn_start_reply(struct uring_server *srv, struct conn *c, const struct proto_reply *reply) {
+    c->replay_off = reply->off;
+    c->replay_end = reply->end;
+    c->replay_start = stats_now();
+    c->msg = reply->msg;
+    c->msg_len = reply->msg_len;
+    c->msg_sent = 0;
+    c->framed = reply->framed;
+
+    if (c->msg) {
+        conn_step_msg(srv, c);
+    } else {
+        conn_step_replay(srv, c);
+    }
+}
+
+/**
+ * Serve the request at the head of the receive buffer and start replying.  The store
+ * write is synchronous; a page cache append is short next to the replay,
+ * and it keeps the log index, retention and mirror in one place.
+ *
+ * A mergeable replay first serves whatever else is buffered, as long as each
+ * reply covers the one before it; the first that does not waits in
+ * c->pending for the replay to finish.
+ */
+static void conn_step_commit(struct uring_server *srv, struct conn *c) {
+    struct proto_reply reply;
+    if (proto_serve(&c->rx, c->frame_len, &reply) < 0) {
+        c->closing = true;
+        return;
+    }
+    c->frame_len = 0;
+
+    ssize_t len;
+    while (reply.mergeable && (len = proto_frame(&c->rx)) > 0) {
+        struct proto_reply next;
+        if (proto_serve(&c->rx, len, &next) < 0) {
+            c->closing = true;
+            return;
+        }
+        if (!next.mergeable || next.off > reply.off || next.end < reply.end) {
+            c->pending = next;
+            c->has_pending = true;
+            break;
+        }
+        stats_count(STAT_COALESCED, 1);
+        reply = next;
+    }
+    conn_start_reply(srv, c, &reply);
+}
+
+static void conn_free(struct uring_server *srv, struct conn *c) {
+    LIST_REMOVE(c, entries);
+    if (c->slot >= 0) {
+        srv->slot_used[c->slot] = false;
+    } else {
+        free(c->chunk);
+    }
+    close(c->fd);
+    stats_conn_close();
+    rx_buf_release(&c->rx);
+    free(c->msg);
+    if (c->has_pending) free(c->pending.msg);
+    free(c);
+}
+
+// Evaluate a READ -> SEND pair once both CQEs are in
+static void conn_chunk_done(struct uring_server *srv, struct conn *c) {
+    int rread = c->res[OP_READ];
+    int rsend = c->res[OP_SEND];
+
+    store_span_put(&c->span);
+    if (rread <= 0) {
+        conn_replay_done(srv, c);
+        return;
+    }
+
+    c->replay_off += rread;
+    c->chunk_len = rread;
+    c->chunk_sent = 0;
+    if (rsend == -ECANCELED) rsend = 0;     // short read cut the link
+    if (rsend < 0) {
+        c->closing = true;
+        return;
+    }
+    stats_count(STAT_BYTES_OUT, rsend);
+    c->chunk_sent = rsend;
+    if (c->chunk_sent < c->chunk_len) {
+        conn_step_send(srv, c);
+    } else {
+        conn_step_replay(srv, c);
+    }
+}
+
+static void conn_advance(struct uring_server *srv, struct conn *c) {
+    switch (c->step) {
+    case STEP_RECV: {
+        int n = c->res[OP_RECV];
+        if (n <= 0) {
+            c->closing = true;
+            return;
+        }
+        stats_count(STAT_BYTES_IN, n);
+        rx_buf_added(&c->rx, n);
+        conn_step_next(srv, c);
+        return;
+    }
+    case STEP_REPLAY:
+        conn_chunk_done(srv, c);
+        return;
+    case STEP_SEND: {
+        int rsend = c->res[OP_SEND];
+        if (rsend <= 0) {
+            c->closing = true;
+            return;
+        }
+        stats_count(STAT_BYTES_OUT, rsend);
+        c->chunk_sent += rsend;
+        if (c->chunk_sent < c->chunk_len) {
+            conn_step_send(srv, c);
+        } else {
+            conn_step_replay(srv, c);
+        }
+        return;
+    }
+    case STEP_MSG: {
+        int rsend = c->res[OP_SEND];
+        if (rsend <= 0) {
+            c->closing = true;
+            return;
+        }
+        stats_count(STAT_BYTES_OUT, rsend);
+        c->msg_sent += rsend;
+        if (c->msg_sent < c->msg_len) {
+            conn_step_msg(srv, c);
+        } else {
+            conn_step_replay(srv, c);
+        }
+        return;
+    }
+    }
+}
+
+// --- Server ---
+
+static void server_accept(struct uring_server *srv) {
+    if (!srv->accepting) return;
+    struct io_uring_sqe *sqe = uring_get_sqe(&srv->ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void server_new_conn(struct uring_server *srv, int fd) {
+    client_socket_init(fd);
+    stats_conn_open();
+    struct conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+        close(fd);
+        stats_conn_close();
+        return;
+    }
+    c->fd = fd;
+    rx_buf_init(&c->rx);
+    c->slot = -1;
+    for (int i = 0; i < REPLAY_SLOTS; i++) {
+        if (!srv->slot_used[i]) {
+            srv->slot_used[i] = true;
+            c->slot = i;
+            c->chunk = srv->slots + (size_t)i * REPLAY_CHUNK;
+            break;
+        }
+    }
+    if (c->slot < 0) {
+        // Out of registered buffers, plain reads into a private chunk still work
+        c->chunk = malloc(REPLAY_CHUNK);
+        if (!c->chunk) {
+            free(c);
+            close(fd);
+            stats_conn_close();
+            return;
+        }
+    }
+    LIST_INSERT_HEAD(&srv->conns, c, entries);
+    conn_step_recv(srv, c);
+    if (c->closing) conn_free(srv, c);
+}
+
+static void server_complete(struct uring_server *srv, struct io_uring_cqe *cqe) {
+    enum uring_op op = cqe->user_data & OP_MASK;
+    struct conn *c = (struct conn *)(uintptr_t)(cqe->user_data & ~OP_MASK);
+
+    if (op == OP_ACCEPT) {
+        if (cqe->res >= 0) {
+            server_new_conn(srv, cqe->res);
+        } else if (cqe->res == -EINVAL || cqe->res == -EBADF) {
+            srv->accepting = false;     // listener was shut down
+        }
+        server_accept(srv);
+        return;
+    }
+
+    c->res[op] = cqe->res;
+    if (--c->inflight > 0) return;
+
+    if (!c->closing) conn_advance(srv, c);
+    if (c->closing && c->inflight == 0) conn_free(srv, c);
+}
+
+static int server_setup(struct uring_server *srv, int listen_fd) {
+    memset(srv, 0, sizeof(*srv));
+    srv->listen_fd = listen_fd;
+    srv->accepting = true;
+    LIST_INIT(&srv->conns);
+
+    if (uring_init(&srv->ring, URING_ENTRIES) < 0) {
+        if (errno == EPERM || errno == EINVAL) errno = ENOSYS;
+        return -1;
+    }
+    if (!uring_probe(&srv->ring)) {
+        uring_exit(&srv->ring);
+        errno = ENOSYS;
+        return -1;
+    }
+
+
+    srv->slots = mmap(NULL, (size_t)REPLAY_SLOTS * REPLAY_CHUNK, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (srv->slots == MAP_FAILED) goto fail_ring;
+
+    struct iovec *iov = calloc(REPLAY_SLOTS, sizeof(*iov));
+    if (!iov) goto fail_slots;
+    for (int i = 0; i < REPLAY_SLOTS; i++) {
+        iov[i].iov_base = srv->slots + (size_t)i * REPLAY_CHUNK;
+        iov[i].iov_len = REPLAY_CHUNK;
+    }
+    int rc = sys_io_uring_register(srv->ring.fd, IORING_REGISTER_BUFFERS, iov, REPLAY_SLOTS);
+    free(iov);
+    if (rc < 0) {
+        // Usually RLIMIT_MEMLOCK; every client then uses a private chunk instead
+        syslog(LOG_WARNING, "io_uring buffer registration failed: %s", strerror(errno));
+        for (int i = 0; i < REPLAY_SLOTS; i++) srv->slot_used[i] = true;
+    }
+    return 0;
+
+fail_slots:
+    munmap(srv->slots, (size_t)REPLAY_SLOTS * REPLAY_CHUNK);
+fail_ring:
+    uring_exit(&srv->ring);
+    return -1;
+}
+
+int uring_model_run(int listen_fd) {
+    struct uring_server srv;
+
+    if (server_setup(&srv, listen_fd) < 0) return -1;
+    syslog(LOG_INFO, "io_uring backend started");
+
+    server_accept(&srv);
+    while (!signal_caught) {
+        if (uring_enter(&srv.ring, 1) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            syslog(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+            break;
+        }
+
+        unsigned head = *srv.ring.cq_head;
+        unsigned tail = __atomic_load_n(srv.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = srv.ring.cqes[head & *srv.ring.cq_mask];
+            head++;
+            __atomic_store_n(srv.ring.cq_head, head, __ATOMIC_RELEASE);
+            srv.ring.inflight--;
+            server_complete(&srv, &cqe);
+            tail = __atomic_load_n(srv.ring.cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    /*
+     * The kernel may still write into conn buffers: shut every socket down so
+     * pending ops complete, and reap them all before freeing anything.
+     */
+    srv.accepting = false;
+    shutdown(listen_fd, SHUT_RDWR);
+    struct conn *c;
+    LIST_FOREACH(c, &srv.conns, entries) {
+        c->closing = true;
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    while (srv.ring.inflight > 0) {
+        if (uring_enter(&srv.ring, 1) < 0 && errno != EINTR) break;
+        unsigned head = *srv.ring.cq_head;
+        unsigned tail = __atomic_load_n(srv.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = srv.ring.cqes[head & *srv.ring.cq_mask];
+            head++;
+            __atomic_store_n(srv.ring.cq_head, head, __ATOMIC_RELEASE);
+            srv.ring.inflight--;
+            if ((cqe.user_data & OP_MASK) != OP_ACCEPT) server_complete(&srv, &cqe);
+        }
+    }
+
+    while (!LIST_EMPTY(&srv.conns)) conn_free(&srv, LIST_FIRST(&srv.conns));
+    uring_exit(&srv.ring);
+    munmap(srv.slots, (size_t)REPLAY_SLOTS * REPLAY_CHUNK);
+    return 0;
+}
+
+#else /* no <linux/io_uring.h> */
+
+int uring_model_run(int listen_fd) {
+    (void)listen_fd;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif